@@ -1,12 +1,27 @@
 
 #include "assembly.h"
 #include <stdlib.h>
-#include <semaphore.h>
 #include <time.h>
 #include <unistd.h>
 #include <errno.h>
 #include <stdio.h>
 #include <pthread.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <math.h>
+#include <ctype.h>
+#include <limits.h>
+#include "assembly_library.h"
+#include "line_topology.h"
+#ifdef PERF_COUNTERS
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+// RUSAGE_THREAD n'est déclaré qu'avec _GNU_SOURCE, qui redéfinit error_t
+#if defined(__linux__) && !defined(RUSAGE_THREAD)
+#define RUSAGE_THREAD 1
+#endif
 
 typedef struct {
     unsigned int status;
@@ -87,31 +102,22 @@ void sleep_until(struct timespec *ts, unsigned long long int delay) {
 // END TIMINGS
 // BEGIN CAR
 
-#define ENUM_TO_FLAG(part) (1 << part)
+#define FLAG_ENTRY(x, part, req) [part] = PART_FLAG(part),
+#define REQUIREMENTS_ENTRY(x, part, req) [part] = (req),
 
 const unsigned int FLAGS[NUM_PARTS] = {
-    ENUM_TO_FLAG(PART_FRAME),
-    ENUM_TO_FLAG(PART_ENGINE),
-    ENUM_TO_FLAG(PART_WHEELS),
-    ENUM_TO_FLAG(PART_BODY),
-    ENUM_TO_FLAG(PART_DOORS),
-    ENUM_TO_FLAG(PART_WINDOWS),
-    ENUM_TO_FLAG(PART_LIGHTS),
+    LINE_PARTS(FLAG_ENTRY, 0)
 };
 
 const unsigned int REQUIREMENTS[NUM_PARTS] = {
-    0,
-    FLAGS[PART_FRAME],
-    FLAGS[PART_FRAME],
-    FLAGS[PART_ENGINE],
-    FLAGS[PART_BODY],
-    FLAGS[PART_DOORS],
-    FLAGS[PART_BODY],
-    0,
+    LINE_PARTS(REQUIREMENTS_ENTRY, 0)
 };
 
 #define GET_REQUIREMENTS(part) REQUIREMENTS[part]
 
+// Statut d'une voiture dont toutes les parties sont installées
+#define COMPLETE_STATUS LINE_COMPLETE_STATUS
+
 void init_car(car_t *car) {
     if (!car) return;
     car->status = 0;
@@ -127,12 +133,204 @@ error_t install(car_t *car, part_t part) {
     return INSTALL_REQUIREMENTS;
 }
 
+// Installe une partie dont les masques sont connus à la compilation
+static inline error_t install_flags(car_t *car, unsigned int req, unsigned int flag) {
+    if ((car->status & req) == req) {
+        car->status |= flag;
+        return OK;
+    }
+    return INSTALL_REQUIREMENTS;
+}
+
 int check_car(car_t *car) {
     if (!car) return INVALID_POINTER;
-    return (car->status == (1 << (NUM_PARTS-1)) - 1);
+    return (car->status == COMPLETE_STATUS);
 }
 
 // END CAR
+// BEGIN CAR BATCH
+
+// Les statuts sont traités par mots de 64 voitures (un mot de masque)
+#define BATCH_WORD 64
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define BATCH_X86
+#include <immintrin.h>
+#endif
+
+// Installe une partie sur 64 voitures, retourne le masque des échecs
+typedef uint64_t (*install_word_t)(unsigned int *status, unsigned int req, unsigned int flag);
+// Vérifie 64 voitures, retourne le masque des voitures complètes
+typedef uint64_t (*check_word_t)(const unsigned int *status);
+
+struct car_batch {
+    unsigned int *status;
+    size_t size;
+    size_t words;
+    install_word_t install_word;
+    check_word_t check_word;
+};
+
+static uint64_t install_word_scalar(unsigned int *status, unsigned int req, unsigned int flag) {
+    uint64_t fail = 0;
+    for (int i = 0; i < BATCH_WORD; i++) {
+        unsigned int ok = (status[i] & req) == req;
+        status[i] |= flag & -ok;
+        fail |= (uint64_t)!ok << i;
+    }
+    return fail;
+}
+
+static uint64_t check_word_scalar(const unsigned int *status) {
+    uint64_t res = 0;
+    for (int i = 0; i < BATCH_WORD; i++) {
+        res |= (uint64_t)(status[i] == COMPLETE_STATUS) << i;
+    }
+    return res;
+}
+
+#ifdef BATCH_X86
+__attribute__((target("sse2")))
+static uint64_t install_word_sse2(unsigned int *status, unsigned int req, unsigned int flag) {
+    const __m128i vreq = _mm_set1_epi32(req);
+    const __m128i vflag = _mm_set1_epi32(flag);
+    uint64_t ok = 0;
+    for (int i = 0; i < BATCH_WORD; i += 4) {
+        __m128i s = _mm_load_si128((const __m128i *)(status + i));
+        __m128i m = _mm_cmpeq_epi32(_mm_and_si128(s, vreq), vreq);
+        _mm_store_si128((__m128i *)(status + i), _mm_or_si128(s, _mm_and_si128(m, vflag)));
+        ok |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(m)) << i;
+    }
+    return ~ok;
+}
+
+__attribute__((target("sse2")))
+static uint64_t check_word_sse2(const unsigned int *status) {
+    const __m128i full = _mm_set1_epi32(COMPLETE_STATUS);
+    uint64_t res = 0;
+    for (int i = 0; i < BATCH_WORD; i += 4) {
+        __m128i s = _mm_load_si128((const __m128i *)(status + i));
+        __m128i m = _mm_cmpeq_epi32(s, full);
+        res |= (uint64_t)_mm_movemask_ps(_mm_castsi128_ps(m)) << i;
+    }
+    return res;
+}
+
+__attribute__((target("avx2")))
+static uint64_t install_word_avx2(unsigned int *status, unsigned int req, unsigned int flag) {
+    const __m256i vreq = _mm256_set1_epi32(req);
+    const __m256i vflag = _mm256_set1_epi32(flag);
+    uint64_t ok = 0;
+    for (int i = 0; i < BATCH_WORD; i += 8) {
+        __m256i s = _mm256_load_si256((const __m256i *)(status + i));
+        __m256i m = _mm256_cmpeq_epi32(_mm256_and_si256(s, vreq), vreq);
+        _mm256_store_si256((__m256i *)(status + i), _mm256_or_si256(s, _mm256_and_si256(m, vflag)));
+        ok |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(m)) << i;
+    }
+    return ~ok;
+}
+
+__attribute__((target("avx2")))
+static uint64_t check_word_avx2(const unsigned int *status) {
+    const __m256i full = _mm256_set1_epi32(COMPLETE_STATUS);
+    uint64_t res = 0;
+    for (int i = 0; i < BATCH_WORD; i += 8) {
+        __m256i s = _mm256_load_si256((const __m256i *)(status + i));
+        __m256i m = _mm256_cmpeq_epi32(s, full);
+        res |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(m)) << i;
+    }
+    return res;
+}
+#endif
+
+error_t init_car_batch(car_batch_t *batch, size_t size) {
+    if (!batch) return INVALID_POINTER;
+    struct car_batch *inner = calloc(1, sizeof(struct car_batch));
+    if (inner == NULL) return MALLOC_ERROR;
+    inner->size = size;
+    inner->words = CAR_BATCH_MASK_WORDS(size);
+    // Le tableau est complété jusqu'à un mot entier : les voitures en trop
+    // sont traitées mais ignorées dans les masques
+    size_t bytes = (inner->words ? inner->words : 1) * BATCH_WORD * sizeof(unsigned int);
+    inner->status = aligned_alloc(64, bytes);
+    if (inner->status == NULL) {
+        free(inner);
+        return MALLOC_ERROR;
+    }
+    memset(inner->status, 0, bytes);
+    inner->install_word = install_word_scalar;
+    inner->check_word = check_word_scalar;
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        inner->install_word = install_word_avx2;
+        inner->check_word = check_word_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        inner->install_word = install_word_sse2;
+        inner->check_word = check_word_sse2;
+    }
+#endif
+    *batch = inner;
+    return OK;
+}
+
+error_t free_car_batch(car_batch_t *batch) {
+    if (batch == NULL || *batch == NULL) return OK;
+    free((*batch)->status);
+    free(*batch);
+    *batch = NULL;
+    return OK;
+}
+
+void reset_car_batch(car_batch_t batch) {
+    if (!batch) return;
+    memset(batch->status, 0, batch->words * BATCH_WORD * sizeof(unsigned int));
+}
+
+unsigned int *car_batch_status(car_batch_t batch) {
+    if (!batch) return NULL;
+    return batch->status;
+}
+
+size_t car_batch_size(car_batch_t batch) {
+    if (!batch) return 0;
+    return batch->size;
+}
+
+// Masque des voitures réellement présentes dans le mot w
+static uint64_t batch_word_mask(car_batch_t batch, size_t w) {
+    size_t rest = batch->size - w * BATCH_WORD;
+    return rest >= BATCH_WORD ? ~(uint64_t)0 : ((uint64_t)1 << rest) - 1;
+}
+
+error_t install_car_batch(car_batch_t batch, part_t part, uint64_t *failures) {
+    if (!batch) return INVALID_POINTER;
+    unsigned int req = GET_REQUIREMENTS(part);
+    unsigned int flag = FLAGS[part];
+    uint64_t any = 0;
+    for (size_t w = 0; w < batch->words; w++) {
+        uint64_t fail = batch->install_word(batch->status + w * BATCH_WORD, req, flag);
+        fail &= batch_word_mask(batch, w);
+        if (failures) failures[w] = fail;
+        any |= fail;
+    }
+    return any ? INSTALL_REQUIREMENTS : OK;
+}
+
+error_t check_car_batch(car_batch_t batch, uint64_t *results, size_t *completed) {
+    if (!batch) return INVALID_POINTER;
+    size_t count = 0;
+    for (size_t w = 0; w < batch->words; w++) {
+        uint64_t res = batch->check_word(batch->status + w * BATCH_WORD);
+        res &= batch_word_mask(batch, w);
+        if (results) results[w] = res;
+        count += __builtin_popcountll(res);
+    }
+    if (completed) *completed = count;
+    return OK;
+}
+
+// END CAR BATCH
 // BEGIN STATS
 
 void init_stats(stats_t *stats) {
@@ -152,8 +350,543 @@ void print_stats(stats_t *stats) {
 }
 
 // END STATS
+// BEGIN USAGE
+
+typedef struct {
+    char name[32];
+    // Mesure une tâche exécutée par un thread déjà suivi : non comptée dans
+    // les totaux
+    int nested;
+    // Totaux, protégés par usage_mutex
+    unsigned long long int cpu_ns;
+    unsigned long long int wall_ns;
+    unsigned long long int nvcsw;
+    unsigned long long int nivcsw;
+    // Début de la mesure en cours, utilisé seulement par le thread mesuré
+    unsigned long long int mark_cpu_ns;
+    unsigned long long int mark_wall_ns;
+    unsigned long long int mark_nvcsw;
+    unsigned long long int mark_nivcsw;
+} thread_usage_t;
+
+typedef struct {
+    thread_usage_t threads[MAX_TRACKED_THREADS];
+    int count;
+    // Enregistrements refusés faute de place : leur consommation manque
+    int dropped;
+    pthread_mutex_t usage_mutex;
+} usage_t;
+
+unsigned long long int timespec_ns(const struct timespec *ts) {
+    return (unsigned long long int)ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void read_thread_usage(unsigned long long int *cpu_ns, unsigned long long int *wall_ns,
+                       unsigned long long int *nvcsw, unsigned long long int *nivcsw) {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    *cpu_ns = timespec_ns(&ts);
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    *wall_ns = timespec_ns(&ts);
+#ifdef RUSAGE_THREAD
+    struct rusage ru;
+    getrusage(RUSAGE_THREAD, &ru);
+    *nvcsw = ru.ru_nvcsw;
+    *nivcsw = ru.ru_nivcsw;
+#else
+    *nvcsw = 0;
+    *nivcsw = 0;
+#endif
+}
+
+int init_usage(usage_t *usage) {
+    if (!usage) return -1;
+    usage->count = 0;
+    usage->dropped = 0;
+    return pthread_mutex_init(&usage->usage_mutex, NULL);
+}
+
+int destroy_usage(usage_t *usage) {
+    if (!usage) return 0;
+    return pthread_mutex_destroy(&usage->usage_mutex);
+}
+
+error_t add_usage_thread(usage_t *usage, const char *name, int nested, int *slot) {
+    if (!usage || !name || !slot) return INVALID_POINTER;
+    error_t res = OK;
+    pthread_mutex_lock(&usage->usage_mutex);
+    if (usage->count >= MAX_TRACKED_THREADS) {
+        usage->dropped++;
+        res = TOO_MANY_THREADS;
+        goto full;
+    }
+    *slot = usage->count++;
+    memset(&usage->threads[*slot], 0, sizeof(thread_usage_t));
+    snprintf(usage->threads[*slot].name, sizeof(usage->threads[*slot].name), "%s", name);
+    usage->threads[*slot].nested = nested;
+full:
+    pthread_mutex_unlock(&usage->usage_mutex);
+    return res;
+}
+
+void begin_usage(usage_t *usage, int slot) {
+    if (!usage || slot < 0 || slot >= usage->count) return;
+    thread_usage_t *t = &usage->threads[slot];
+    read_thread_usage(&t->mark_cpu_ns, &t->mark_wall_ns, &t->mark_nvcsw, &t->mark_nivcsw);
+}
+
+void sample_usage(usage_t *usage, int slot) {
+    if (!usage || slot < 0 || slot >= usage->count) return;
+    thread_usage_t *t = &usage->threads[slot];
+    unsigned long long int cpu, wall, nvcsw, nivcsw;
+    read_thread_usage(&cpu, &wall, &nvcsw, &nivcsw);
+    pthread_mutex_lock(&usage->usage_mutex);
+    t->cpu_ns += cpu - t->mark_cpu_ns;
+    t->wall_ns += wall - t->mark_wall_ns;
+    t->nvcsw += nvcsw - t->mark_nvcsw;
+    t->nivcsw += nivcsw - t->mark_nivcsw;
+    pthread_mutex_unlock(&usage->usage_mutex);
+    t->mark_cpu_ns = cpu;
+    t->mark_wall_ns = wall;
+    t->mark_nvcsw = nvcsw;
+    t->mark_nivcsw = nivcsw;
+}
+
+void print_usage(usage_t *usage, unsigned long long int built_cars) {
+    if (!usage) return;
+    unsigned long long int total_cpu = 0, total_wall = 0;
+    pthread_mutex_lock(&usage->usage_mutex);
+    printf("%-12s %10s %10s %8s %8s %8s %8s\n",
+           "Thread", "CPU (s)", "Wall (s)", "Busy", "Blocked", "Vol. cs", "Inv. cs");
+    for (int i = 0; i < usage->count; i++) {
+        thread_usage_t *t = &usage->threads[i];
+        double busy = t->wall_ns ? (double)t->cpu_ns / t->wall_ns : 0;
+        // Les deux horloges ne sont pas lues au même instant
+        if (busy > 1) busy = 1;
+        printf("%s%-*s %10.3f %10.3f %7.2f%% %7.2f%% %8llu %8llu\n", t->nested ? "  " : "",
+               t->nested ? 10 : 12, t->name, t->cpu_ns / 1e9, t->wall_ns / 1e9, busy * 100,
+               t->wall_ns ? (1 - busy) * 100 : 0, t->nvcsw, t->nivcsw);
+        if (t->nested) continue;
+        total_cpu += t->cpu_ns;
+        total_wall += t->wall_ns;
+    }
+    int dropped = usage->dropped;
+    pthread_mutex_unlock(&usage->usage_mutex);
+    if (dropped) {
+        printf("%d threads or tasks not tracked (MAX_TRACKED_THREADS reached): totals are under-counted\n",
+               dropped);
+    }
+    printf("Total CPU: %.3f s\n", total_cpu / 1e9);
+    if (built_cars) {
+        printf("CPU per built car: %.6f s\n", total_cpu / 1e9 / built_cars);
+    } else {
+        printf("CPU per built car: -\n");
+    }
+    printf("Idle fraction: %f\n", total_wall ? 1 - (double)total_cpu / total_wall : 0);
+}
+
+// END USAGE
+// BEGIN FAULTS
+
+// Nombre maximum de sections dans un fichier de profils
+#define MAX_PROFILE_SECTIONS (MAX_POSITION*3 + 1)
+
+typedef struct {
+    fault_profile_t profile;
+    // Date d'application du profil (CLOCK_MONOTONIC)
+    unsigned long long int since_ns;
+    // Entrée des statistiques où sont comptés les blocages de ce bras
+    int stats;
+} fault_t;
+
+// Statistiques d'un profil, identifié par son nom. Les voitures et le temps de
+// fonctionnement ne sont comptés que lorsque le profil est celui de la ligne,
+// les blocages et reprises pour chaque bras qui l'utilise
+typedef struct {
+    char name[32];
+    // Le profil a été appliqué à toute la ligne
+    int line_profile;
+    // Ordre de création de l'entrée, pour réutiliser la plus ancienne
+    unsigned long long int created;
+    unsigned long long int built_cars;
+    unsigned long long int failed_cars;
+    unsigned long long int blocks;
+    unsigned long long int outage_blocks;
+    unsigned long long int recoveries;
+    unsigned long long int recovery_ns;
+    unsigned long long int max_recovery_ns;
+    unsigned long long int run_ns;
+} profile_stats_t;
+
+unsigned long long int monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return timespec_ns(&ts);
+}
+
+void default_fault_profile(fault_profile_t *profile) {
+    if (!profile) return;
+    memset(profile, 0, sizeof(fault_profile_t));
+    snprintf(profile->name, sizeof(profile->name), "default");
+    profile->delay_law = DELAY_UNIFORM;
+    profile->min_delay = MIN_DELAY;
+    profile->max_delay = MAX_DELAY;
+    profile->pareto_alpha = 1.5;
+    profile->one_in_block_chance = ONE_IN_BLOCK_CHANCE;
+}
+
+int valid_fault_profile(const fault_profile_t *profile) {
+    if (profile->min_delay > profile->max_delay) return 0;
+    if (profile->max_delay > MAX_FAULT_DELAY) return 0;
+    if (profile->burst_period && profile->burst_length > profile->burst_period) return 0;
+    if (profile->outage_period && profile->outage_length > profile->outage_period) return 0;
+    if (profile->delay_law == DELAY_PARETO) {
+        return profile->min_delay > 0 && profile->pareto_alpha > 0;
+    }
+    return profile->delay_law == DELAY_UNIFORM;
+}
+
+void init_fault(fault_t *fault, const fault_profile_t *profile) {
+    if (!fault) return;
+    fault->profile = *profile;
+    fault->since_ns = monotonic_ns();
+}
+
+// Tire un délai d'installation en ms
+unsigned int fault_delay(const fault_t *fault) {
+    const fault_profile_t *p = &fault->profile;
+    if (p->delay_law == DELAY_PARETO) {
+        double u = (rand() + 1.0) / (RAND_MAX + 1.0);
+        double delay = p->min_delay / pow(u, 1 / p->pareto_alpha);
+        return delay > p->max_delay ? p->max_delay : (unsigned int)delay;
+    }
+    return rand() % (p->max_delay - p->min_delay + 1) + p->min_delay;
+}
+
+double one_in_to_probability(unsigned int one_in) {
+    return one_in ? 1.0 / one_in : 0;
+}
+
+// Tire un blocage : 0 si pas de blocage, 1 si blocage, 2 si panne programmée
+int fault_block(const fault_t *fault) {
+    const fault_profile_t *p = &fault->profile;
+    unsigned long long int elapsed = (monotonic_ns() - fault->since_ns) / 1000000;
+    if (p->outage_length && elapsed >= p->outage_start) {
+        unsigned long long int in_outage = elapsed - p->outage_start;
+        if (p->outage_period) in_outage %= p->outage_period;
+        if (in_outage < p->outage_length) return 2;
+    }
+    double chance = one_in_to_probability(p->one_in_block_chance);
+    if (p->ramp_duration) {
+        double ramp = elapsed >= p->ramp_duration ? 1 : (double)elapsed / p->ramp_duration;
+        chance += (one_in_to_probability(p->ramp_one_in_block_chance) - chance) * ramp;
+    }
+    if (p->burst_period && elapsed % p->burst_period < p->burst_length) {
+        double burst = one_in_to_probability(p->burst_one_in_block_chance);
+        if (burst > chance) chance = burst;
+    }
+    return rand() < chance * (RAND_MAX + 1.0);
+}
+
+void print_profile_stats(const profile_stats_t *stats) {
+    printf("Profile %s:\n", stats->name);
+    if (stats->line_profile) {
+        printf("  Cars: %llu built, %llu failed\n", stats->built_cars, stats->failed_cars);
+    }
+    if (stats->run_ns) {
+        printf("  Throughput: %f cars/min\n", stats->built_cars * 60e9 / stats->run_ns);
+    }
+    printf("  Blocks: %llu (%llu in outage)\n", stats->blocks, stats->outage_blocks);
+    if (stats->recoveries) {
+        printf("  Recoveries: %llu (avg %.3f s, max %.3f s)\n", stats->recoveries,
+               stats->recovery_ns / 1e9 / stats->recoveries, stats->max_recovery_ns / 1e9);
+    } else {
+        printf("  Recoveries: 0\n");
+    }
+}
+
+// Lit une section "[...]" du fichier de profils. Retourne la position visée
+// (0 pour toute la ligne) et met à jour *side (-1 pour les deux côtés)
+error_t parse_profile_section(const char *header, int *line, unsigned int *position, int *side) {
+    char side_name[8];
+    *line = 0;
+    if (strncmp(header, "[line]", 6) == 0) {
+        *line = 1;
+        *position = 0;
+        *side = -1;
+        return OK;
+    }
+    if (sscanf(header, "[station %u]", position) == 1) {
+        *side = -1;
+        return OK;
+    }
+    if (sscanf(header, "[arm %7s %u]", side_name, position) == 2) {
+        if (strcmp(side_name, "left") == 0) {
+            *side = LEFT;
+            return OK;
+        }
+        if (strcmp(side_name, "right") == 0) {
+            *side = RIGHT;
+            return OK;
+        }
+    }
+    return PROFILE_ERROR;
+}
+
+// Entier positif en base 10, sans signe ni caractère en trop
+error_t parse_profile_uint(const char *value, unsigned int *field) {
+    if (!isdigit((unsigned char)*value)) return PROFILE_ERROR;
+    char *end;
+    errno = 0;
+    unsigned long int number = strtoul(value, &end, 10);
+    if (*end != '\0' || errno == ERANGE || number > UINT_MAX) return PROFILE_ERROR;
+    *field = (unsigned int)number;
+    return OK;
+}
+
+error_t parse_profile_entry(const char *key, const char *value, fault_profile_t *profile) {
+    unsigned int *field = NULL;
+    if (strcmp(key, "name") == 0) {
+        snprintf(profile->name, sizeof(profile->name), "%s", value);
+        return OK;
+    }
+    if (strcmp(key, "delay_law") == 0) {
+        if (strcmp(value, "uniform") == 0) profile->delay_law = DELAY_UNIFORM;
+        else if (strcmp(value, "pareto") == 0) profile->delay_law = DELAY_PARETO;
+        else return PROFILE_ERROR;
+        return OK;
+    }
+    if (strcmp(key, "pareto_alpha") == 0) {
+        char *end;
+        double alpha = strtod(value, &end);
+        if (end == value || *end != '\0' || !isfinite(alpha)) return PROFILE_ERROR;
+        profile->pareto_alpha = alpha;
+        return OK;
+    }
+    if (strcmp(key, "min_delay") == 0) field = &profile->min_delay;
+    else if (strcmp(key, "max_delay") == 0) field = &profile->max_delay;
+    else if (strcmp(key, "one_in_block_chance") == 0) field = &profile->one_in_block_chance;
+    else if (strcmp(key, "ramp_one_in_block_chance") == 0) field = &profile->ramp_one_in_block_chance;
+    else if (strcmp(key, "ramp_duration") == 0) field = &profile->ramp_duration;
+    else if (strcmp(key, "burst_period") == 0) field = &profile->burst_period;
+    else if (strcmp(key, "burst_length") == 0) field = &profile->burst_length;
+    else if (strcmp(key, "burst_one_in_block_chance") == 0) field = &profile->burst_one_in_block_chance;
+    else if (strcmp(key, "outage_start") == 0) field = &profile->outage_start;
+    else if (strcmp(key, "outage_length") == 0) field = &profile->outage_length;
+    else if (strcmp(key, "outage_period") == 0) field = &profile->outage_period;
+    if (!field) return PROFILE_ERROR;
+    return parse_profile_uint(value, field);
+}
+
+// Retire les espaces au début et à la fin de la chaîne
+char *trim(char *str) {
+    while (isspace((unsigned char)*str)) str++;
+    char *end = str + strlen(str);
+    while (end > str && isspace((unsigned char)end[-1])) end--;
+    *end = '\0';
+    return str;
+}
+
+// END FAULTS
+// BEGIN PERF
+
+#ifdef PERF_COUNTERS
+
+#define PERF_EVENTS 5
+
+// Sections mesurées
+typedef enum {
+    REGION_TRIGGER = 0,
+    REGION_BELT_LOOP = 1,
+    REGION_BELT_POSITION = 2,
+    REGION_STATS = 3,
+    NUM_REGIONS = 4
+} perf_region_t;
+
+const char *REGION_NAMES[NUM_REGIONS] = {
+    "trigger_arm",
+    "belt loop",
+    "belt position",
+    "stats",
+};
+
+const struct {
+    unsigned int type;
+    unsigned long long int config;
+} PERF_CONFIG[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES},
+};
+
+// Totaux d'une section, mis à jour par plusieurs threads
+typedef struct {
+    _Atomic unsigned long long int calls;
+    _Atomic unsigned long long int values[PERF_EVENTS];
+} perf_counts_t;
+
+typedef struct {
+    unsigned long long int values[PERF_EVENTS];
+    int valid;
+} perf_mark_t;
+
+// Compteurs du thread courant, ouverts au premier usage dans un groupe lu en
+// un seul appel. events[i] est la place de l'évènement i dans le groupe, -1
+// s'il n'est pas disponible (pas de PMU, perf_event_paranoid...)
+static __thread int perf_leader = -2;
+static __thread int perf_events[PERF_EVENTS];
+static __thread int perf_count;
+// Évènements ouverts par au moins un thread
+_Atomic int perf_available = 0;
+
+void perf_open_thread() {
+    perf_leader = -1;
+    perf_count = 0;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_CONFIG[i].type;
+        attr.config = PERF_CONFIG[i].config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_hv = 1;
+        // Les changements de contexte ont lieu dans le noyau : on ne les
+        // exclut que si on n'a pas le droit de les observer
+        attr.exclude_kernel = attr.type != PERF_TYPE_SOFTWARE;
+        int fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf_leader, 0);
+        if (fd < 0 && !attr.exclude_kernel) {
+            attr.exclude_kernel = 1;
+            fd = syscall(SYS_perf_event_open, &attr, 0, -1, perf_leader, 0);
+        }
+        perf_events[i] = -1;
+        if (fd < 0) continue;
+        if (perf_leader < 0) perf_leader = fd;
+        perf_events[i] = perf_count++;
+        perf_available |= 1 << i;
+    }
+}
+
+void perf_read(perf_mark_t *mark) {
+    if (perf_leader == -2) perf_open_thread();
+    mark->valid = 0;
+    if (perf_leader < 0) return;
+    unsigned long long int buffer[PERF_EVENTS + 1];
+    if (read(perf_leader, buffer, sizeof(buffer)) < (ssize_t)((perf_count + 1) * sizeof(unsigned long long int))) return;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        mark->values[i] = perf_events[i] >= 0 ? buffer[1 + perf_events[i]] : 0;
+    }
+    mark->valid = 1;
+}
+
+// Ajoute les compteurs depuis start à counts et à other (peut être NULL)
+void perf_add(perf_counts_t *counts, perf_counts_t *other, const perf_mark_t *start) {
+    if (!start->valid) return;
+    perf_mark_t end;
+    perf_read(&end);
+    if (!end.valid) return;
+    counts->calls++;
+    if (other) other->calls++;
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        unsigned long long int delta = end.values[i] - start->values[i];
+        counts->values[i] += delta;
+        if (other) other->values[i] += delta;
+    }
+}
+
+void print_perf_header() {
+    printf("%-14s %8s %12s %12s %6s %10s %10s %8s\n", "Region", "Calls", "Cycles",
+           "Instr.", "IPC", "Cache mis.", "Br. mis.", "Ctx sw.");
+}
+
+void print_perf_counts(const char *name, perf_counts_t *counts) {
+    unsigned long long int calls = counts->calls;
+    if (!calls) return;
+    // Valeur moyenne par appel, "-" si l'évènement n'est pas disponible
+    char v[PERF_EVENTS + 1][16];
+    const int precision[PERF_EVENTS] = {0, 0, 1, 1, 2};
+    for (int i = 0; i < PERF_EVENTS; i++) {
+        if (perf_available & (1 << i)) {
+            snprintf(v[i], sizeof(v[i]), "%.*f", precision[i], (double)counts->values[i] / calls);
+        } else {
+            snprintf(v[i], sizeof(v[i]), "-");
+        }
+    }
+    if ((perf_available & 3) == 3 && counts->values[0]) {
+        snprintf(v[PERF_EVENTS], sizeof(v[PERF_EVENTS]), "%.2f", (double)counts->values[1] / counts->values[0]);
+    } else {
+        snprintf(v[PERF_EVENTS], sizeof(v[PERF_EVENTS]), "-");
+    }
+    printf("%-14s %8llu %12s %12s %6s %10s %10s %8s\n", name, calls,
+           v[0], v[1], v[PERF_EVENTS], v[2], v[3], v[4]);
+}
+
+// Déclare une mesure et lit les compteurs du thread courant
+#define PERF_BEGIN(mark) perf_mark_t mark; perf_read(&mark)
+// Ajoute les compteurs depuis PERF_BEGIN(mark) aux totaux donnés
+#define PERF_END(counts, mark) perf_add(counts, NULL, &mark)
+#define PERF_END_BOTH(counts, other, mark) perf_add(counts, other, &mark)
+
+#else
+
+#define PERF_BEGIN(mark)
+#define PERF_END(counts, mark)
+#define PERF_END_BOTH(counts, other, mark)
+
+#endif
+
+// END PERF
 // BEGIN BELT
 
+#ifdef STATIC_TOPOLOGY
+
+// Position de vérification, après le dernier bras robot
+#define CHECK_POSITION(belt) (LINE_LAST_POSITION + 1)
+
+#define ARM_SET(x, part, side, position) (x)->arms[2*((position)-1)+(side)] = part;
+#define ARM_PART_CASE(x, part, side, position) case 2*(position)+(side): *x = part; return OK;
+#define ARM_INSTALL_CASE(x, part, side, position) \
+    case 2*(position)+(side): return install_flags(x, PART_REQUIREMENTS(part), PART_FLAG(part));
+
+void init_belt(belt_t *belt) {
+    if (!belt) return;
+    belt->belt_position = 0;
+    belt->check_position = CHECK_POSITION(belt);
+    for (int i = 0; i < MAX_POSITION*2; i++) {
+        belt->arms[i] = PART_EMPTY;
+    }
+    LINE_ARMS(ARM_SET, belt)
+}
+
+// Les bras robots sont fixés par la topologie, on vérifie seulement que le bras
+// demandé en fait partie
+error_t install_belt_arm(belt_t *belt, part_t part, side_t side, unsigned int position) {
+    if (!belt) return INVALID_POINTER;
+    if (position == 0 || position > MAX_POSITION) return INCORRECT_POSITION;
+    part_t current = belt->arms[2*(position-1)+side];
+    if (current == part) return OK;
+    if (current != PART_EMPTY) return NON_EMPTY_POSITION;
+    return INCORRECT_POSITION;
+}
+
+// Installe la partie du bras robot de la topologie, les dépendances sont des
+// constantes
+error_t install_arm(car_t *car, side_t side, unsigned int position) {
+    switch (2*position+side) {
+        LINE_ARMS(ARM_INSTALL_CASE, car)
+    }
+    return INCORRECT_POSITION;
+}
+
+#define INSTALL_PART(car, side, position, part) install_arm(car, side, position)
+
+#else
+
+#define CHECK_POSITION(belt) ((belt)->check_position)
+
+#define INSTALL_PART(car, side, position, part) install(car, part)
+
 void init_belt(belt_t *belt) {
     if (!belt) return;
     belt->belt_position = 0;
@@ -175,9 +908,11 @@ error_t install_belt_arm(belt_t *belt, part_t part, side_t side, unsigned int po
     return OK;
 }
 
+#endif
+
 void move_belt(belt_t *belt) {
     if (!belt) return;
-    belt->belt_position = (belt->belt_position + 1) % (belt->check_position+1);
+    belt->belt_position = (belt->belt_position + 1) % (CHECK_POSITION(belt)+1);
 }
 
 void handle_belt_position(belt_t *belt, car_t *car, stats_t *stats) {
@@ -186,7 +921,7 @@ void handle_belt_position(belt_t *belt, car_t *car, stats_t *stats) {
     if (belt->belt_position == 0) {
         init_car(car);
         printf("New car arriving.\n");
-    } else if (belt->belt_position == belt->check_position) {
+    } else if (belt->belt_position == CHECK_POSITION(belt)) {
         printf("Checking car...\n");
         if (check_car(car)) {
             printf_green("Car completed.\n");
@@ -199,6 +934,19 @@ void handle_belt_position(belt_t *belt, car_t *car, stats_t *stats) {
     }
 }
 
+#ifdef STATIC_TOPOLOGY
+
+error_t get_part(belt_t *belt, side_t side, unsigned int position, part_t *part) {
+    if (!belt) return INVALID_POINTER;
+    if (belt->belt_position != position) return INCORRECT_BELT_POSITION;
+    switch (2*position+side) {
+        LINE_ARMS(ARM_PART_CASE, part)
+    }
+    return INCORRECT_POSITION;
+}
+
+#else
+
 error_t get_part(belt_t *belt, side_t side, unsigned int position, part_t *part) {
     if (!belt) return INVALID_POINTER;
     error_t res = OK;
@@ -224,6 +972,8 @@ error:
     return res;
 }
 
+#endif
+
 // END BELT
 // BEGIN ASSEMBLY LINE
 
@@ -231,10 +981,37 @@ struct assembly_line {
     car_t car;
     belt_t belt;
     stats_t stats;
+    usage_t usage;
+    int belt_slot;
+    fault_t default_fault;
+    fault_t faults[MAX_POSITION*2];
+    profile_stats_t profile_stats[MAX_PROFILES];
+    int profile_count;
+    unsigned long long int profile_created;
+    // Statistiques de la ligne déjà reportées sur le profil de la ligne
+    unsigned long long int profile_built_mark;
+    unsigned long long int profile_failed_mark;
+    // Début du temps de fonctionnement pas encore reporté, si profile_timing
+    int profile_timing;
+    unsigned long long int profile_run_ns;
+    int blocked;
+    unsigned long long int blocked_ns;
+    // Entrée des statistiques du bras qui a bloqué la ligne
+    int blocked_stats;
     _Atomic int running;
     unsigned long long int ms_delay;
-    sem_t block_sem;
-    pthread_mutex_t safe_mutex;
+    spin_sem_t block_sem;
+    spin_mutex_t safe_mutex;
+    // Un site d'attente par appel bloquant, chacun adapte son attente active
+    wait_site_t belt_sem_site;
+    wait_site_t belt_lock_site;
+    wait_site_t arm_sem_site;
+    wait_site_t arm_lock_site;
+    wait_site_t control_lock_site;
+#ifdef PERF_COUNTERS
+    perf_counts_t perf_regions[NUM_REGIONS];
+    perf_counts_t perf_arms[MAX_POSITION*2];
+#endif
 };
 
 error_t init_assembly_line(assembly_line_t *line) {
@@ -246,17 +1023,23 @@ error_t init_assembly_line(assembly_line_t *line) {
     init_stats(&inner->stats);
     inner->ms_delay = num_iter_delay(1000000);
     inner->running = 0;
-    if (sem_init(&inner->block_sem, 0, 0) != 0) {
-        goto sem_error;
-    }
-    if (pthread_mutex_init(&inner->safe_mutex, NULL) != 0) {
-        goto mutex_error;
+    spin_sem_init(&inner->block_sem, 0);
+    spin_mutex_init(&inner->safe_mutex);
+    inner->belt_sem_site = (wait_site_t)WAIT_SITE("belt sem");
+    inner->belt_lock_site = (wait_site_t)WAIT_SITE("belt lock");
+    inner->arm_sem_site = (wait_site_t)WAIT_SITE("arm sem");
+    inner->arm_lock_site = (wait_site_t)WAIT_SITE("arm lock");
+    inner->control_lock_site = (wait_site_t)WAIT_SITE("control lock");
+    if (init_usage(&inner->usage) != 0) {
+        goto usage_error;
     }
+    add_usage_thread(&inner->usage, "belt", 0, &inner->belt_slot);
+    fault_profile_t profile;
+    default_fault_profile(&profile);
+    set_fault_profile(inner, &profile);
     *line = inner;
     return OK;
-mutex_error:
-    sem_destroy(&inner->block_sem);
-sem_error:
+usage_error:
     free(inner);
     return SEM_ERROR;
 }
@@ -265,11 +1048,7 @@ error_t free_assembly_line(assembly_line_t *line) {
     if (line == NULL) return OK;
     struct assembly_line *inner = *line;
     if (inner == NULL) return OK;
-    int res = sem_destroy(&inner->block_sem);
-    if (res != 0) {
-        return SEM_ERROR;
-    }
-    res = pthread_mutex_destroy(&inner->safe_mutex);
+    int res = destroy_usage(&inner->usage);
     if (res != 0) {
         return SEM_ERROR;
     }
@@ -278,6 +1057,59 @@ error_t free_assembly_line(assembly_line_t *line) {
     return OK;
 }
 
+_Static_assert(MAX_PROFILES > MAX_POSITION*2 + 2, "every arm, the line and a blocked arm may use a different profile");
+
+// Reporte sur le profil de la ligne les voitures produites et le temps de
+// fonctionnement depuis le dernier appel. À appeler avec safe_mutex
+void flush_profile_stats(assembly_line_t line) {
+    if (line->profile_count == 0) return;
+    profile_stats_t *stats = &line->profile_stats[line->default_fault.stats];
+    stats->built_cars += line->stats.built_cars - line->profile_built_mark;
+    stats->failed_cars += line->stats.failed_cars - line->profile_failed_mark;
+    line->profile_built_mark = line->stats.built_cars;
+    line->profile_failed_mark = line->stats.failed_cars;
+    unsigned long long int now = monotonic_ns();
+    if (line->profile_timing) stats->run_ns += now - line->profile_run_ns;
+    line->profile_run_ns = now;
+}
+
+int profile_stats_used(assembly_line_t line, int index) {
+    if (line->default_fault.stats == index) return 1;
+    if (line->blocked && line->blocked_stats == index) return 1;
+    for (int i = 0; i < MAX_POSITION*2; i++) {
+        if (line->faults[i].stats == index) return 1;
+    }
+    return 0;
+}
+
+// Retourne l'entrée des statistiques du profil de ce nom, en la créant si
+// besoin. À appeler avec safe_mutex
+int profile_stats_slot(assembly_line_t line, const char *name) {
+    for (int i = 0; i < line->profile_count; i++) {
+        if (strcmp(line->profile_stats[i].name, name) == 0) return i;
+    }
+    int index = line->profile_count;
+    if (index < MAX_PROFILES) {
+        line->profile_count++;
+    } else {
+        // Il reste toujours une entrée libre (voir le _Static_assert)
+        index = -1;
+        for (int i = 0; i < MAX_PROFILES; i++) {
+            if (profile_stats_used(line, i)) continue;
+            if (index < 0 || line->profile_stats[i].created < line->profile_stats[index].created) index = i;
+        }
+    }
+    memset(&line->profile_stats[index], 0, sizeof(profile_stats_t));
+    line->profile_stats[index].created = line->profile_created++;
+    snprintf(line->profile_stats[index].name, sizeof(line->profile_stats[index].name), "%s", name);
+    return index;
+}
+
+fault_t *get_fault(assembly_line_t line, side_t side, unsigned int position) {
+    if (position == 0 || position > MAX_POSITION) return &line->default_fault;
+    return &line->faults[2*(position-1)+side];
+}
+
 error_t setup_arm(assembly_line_t line, part_t part, side_t side, unsigned int position) {
     if (line->running) return LINE_STARTED;
     return install_belt_arm(&line->belt, part, side, position);
@@ -285,12 +1117,11 @@ error_t setup_arm(assembly_line_t line, part_t part, side_t side, unsigned int p
 
 error_t run_assembly(assembly_line_t line) {
     if (line->running) return LINE_STARTED;
-    int values;
-    sem_getvalue(&line->block_sem, &values);
+    int values = spin_sem_getvalue(&line->block_sem);
     for (int i = 0; i < values; i++) {
-        sem_wait(&line->block_sem);
+        spin_sem_wait(&line->block_sem, &line->belt_sem_site);
     }
-    sem_post(&line->block_sem);
+    spin_sem_post(&line->block_sem);
     line->running = 1;
     printf_green("Assembly line started.\n");
     struct timespec ts;
@@ -298,26 +1129,51 @@ error_t run_assembly(assembly_line_t line) {
     printf("Last position (end of assembly): %d\n", line->belt.check_position);
     line->belt.belt_position = line->belt.check_position;
     line->stats.starts++;
+    begin_usage(&line->usage, line->belt_slot);
+    spin_mutex_lock(&line->safe_mutex, &line->belt_lock_site);
+    unsigned long long int run_start = monotonic_ns();
+    line->profile_run_ns = run_start;
+    line->profile_timing = 1;
+    if (line->blocked) {
+        // La ligne redémarre après un blocage
+        profile_stats_t *stats = &line->profile_stats[line->blocked_stats];
+        unsigned long long int recovery = run_start - line->blocked_ns;
+        stats->recoveries++;
+        stats->recovery_ns += recovery;
+        if (recovery > stats->max_recovery_ns) stats->max_recovery_ns = recovery;
+        line->blocked = 0;
+    }
+    spin_mutex_unlock(&line->safe_mutex);
     while (line->running) {
         if (clock_gettime(CLOCK_REALTIME, &ts) != 0) {
             res = TIME_ERROR;
             goto time_error;
         }
-        sem_wait(&line->block_sem);
-        pthread_mutex_lock(&line->safe_mutex);
+        PERF_BEGIN(loop_mark);
+        spin_sem_wait(&line->block_sem, &line->belt_sem_site);
+        spin_mutex_lock(&line->safe_mutex, &line->belt_lock_site);
         if (line->running) {
             move_belt(&line->belt);
         }
-        sem_post(&line->block_sem);
+        spin_sem_post(&line->block_sem);
         if (!line->running) {
-            pthread_mutex_unlock(&line->safe_mutex);
+            spin_mutex_unlock(&line->safe_mutex);
             goto time_error;
         }
+        PERF_BEGIN(position_mark);
         handle_belt_position(&line->belt, &line->car, &line->stats);
-        pthread_mutex_unlock(&line->safe_mutex);
+        PERF_END(&line->perf_regions[REGION_BELT_POSITION], position_mark);
+        spin_mutex_unlock(&line->safe_mutex);
+        PERF_END(&line->perf_regions[REGION_BELT_LOOP], loop_mark);
         sleep_until(&ts, BELT_PERIOD);
+        sample_usage(&line->usage, line->belt_slot);
     }
 time_error:
+    sample_usage(&line->usage, line->belt_slot);
+    spin_mutex_lock(&line->safe_mutex, &line->belt_lock_site);
+    flush_profile_stats(line);
+    line->profile_timing = 0;
+    spin_mutex_unlock(&line->safe_mutex);
     printf_green("Assembly line stopped.\n");
 car_error:
     return res;
@@ -326,32 +1182,48 @@ car_error:
 error_t trigger_arm(assembly_line_t line, side_t side, unsigned int position) {
     printf("Installing in position %d.\n", line->belt.belt_position);
     if (!line->running) return LINE_STOPPED;
-    sem_wait(&line->block_sem);
-    pthread_mutex_lock(&line->safe_mutex);
+    PERF_BEGIN(trigger_mark);
+    spin_sem_wait(&line->block_sem, &line->arm_sem_site);
+    spin_mutex_lock(&line->safe_mutex, &line->arm_lock_site);
+    fault_t *fault = get_fault(line, side, position);
     part_t part;
+    int block;
     error_t res = get_part(&line->belt, side, position, &part);
     if (res != OK) {
         goto bad_pos;
     }
-    int delay = rand() % (MAX_DELAY - MIN_DELAY + 1) + MIN_DELAY;
+    unsigned int delay = fault_delay(fault);
     for (volatile unsigned long long int i = 0; i < line->ms_delay*delay; i++) {
         
     }
-    res = install(&line->car, part);
+    res = INSTALL_PART(&line->car, side, position, part);
 bad_pos:
-    pthread_mutex_unlock(&line->safe_mutex);
-    int block = (rand() % ONE_IN_BLOCK_CHANCE) == 0;
+    block = fault_block(fault);
+    if (block && line->running) {
+        profile_stats_t *stats = &line->profile_stats[fault->stats];
+        stats->blocks++;
+        if (block == 2) stats->outage_blocks++;
+        if (!line->blocked) {
+            line->blocked = 1;
+            line->blocked_ns = monotonic_ns();
+            line->blocked_stats = fault->stats;
+        }
+    }
+    spin_mutex_unlock(&line->safe_mutex);
     if (!block && line->running) {
-        sem_post(&line->block_sem);
+        spin_sem_post(&line->block_sem);
     }
+    PERF_END_BOTH(&line->perf_regions[REGION_TRIGGER],
+                  position && position <= MAX_POSITION ? &line->perf_arms[2*(position-1)+side] : NULL,
+                  trigger_mark);
     return res;
 }
 
 error_t shutdown_assembly(assembly_line_t line) {
     if (!line->running) return LINE_STOPPED;
-    pthread_mutex_lock(&line->safe_mutex);
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
     printf("Shutting down assembly line.\n");
-    int delay = rand() % (MAX_DELAY - MIN_DELAY + 1) + MIN_DELAY;
+    unsigned int delay = fault_delay(&line->default_fault);
     for (volatile unsigned long long int i = 0; i < line->ms_delay*delay; i++) {
         
     }
@@ -359,17 +1231,373 @@ error_t shutdown_assembly(assembly_line_t line) {
     init_car(&line->car);
     line->belt.belt_position = 0;
     for (int i = 0; i <= MAX_POSITION*2; i++) {
-        sem_post(&line->block_sem);
+        spin_sem_post(&line->block_sem);
     }
-    pthread_mutex_unlock(&line->safe_mutex);
+    spin_mutex_unlock(&line->safe_mutex);
     printf_green("Assembly line shut down.\n");
     return OK;
 }
 
 void print_assembly_stats(assembly_line_t line) {
-    pthread_mutex_lock(&line->safe_mutex);
+    PERF_BEGIN(stats_mark);
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
     print_stats(&line->stats);
-    pthread_mutex_unlock(&line->safe_mutex);
+    flush_profile_stats(line);
+    for (int i = 0; i < line->profile_count; i++) {
+        print_profile_stats(&line->profile_stats[i]);
+    }
+    spin_mutex_unlock(&line->safe_mutex);
+    PERF_END(&line->perf_regions[REGION_STATS], stats_mark);
+#ifdef PERF_COUNTERS
+    print_perf_header();
+    for (int i = 0; i < NUM_REGIONS; i++) {
+        print_perf_counts(REGION_NAMES[i], &line->perf_regions[i]);
+    }
+    for (int i = 0; i < MAX_POSITION*2; i++) {
+        char name[32];
+        snprintf(name, sizeof(name), "arm %s %d", i % 2 == LEFT ? "left" : "right", i/2 + 1);
+        print_perf_counts(name, &line->perf_arms[i]);
+    }
+#endif
+}
+
+// Les fonctions *_locked supposent safe_mutex pris et le profil valide
+
+void set_fault_profile_locked(assembly_line_t line, const fault_profile_t *profile) {
+    // Le profil sortant garde les voitures et le temps jusqu'ici
+    flush_profile_stats(line);
+    int index = profile_stats_slot(line, profile->name);
+    line->profile_stats[index].line_profile = 1;
+    init_fault(&line->default_fault, profile);
+    line->default_fault.stats = index;
+    for (int i = 0; i < MAX_POSITION*2; i++) {
+        line->faults[i] = line->default_fault;
+    }
+}
+
+void set_arm_fault_profile_locked(assembly_line_t line, side_t side, unsigned int position, const fault_profile_t *profile) {
+    fault_t *fault = get_fault(line, side, position);
+    int index = profile_stats_slot(line, profile->name);
+    init_fault(fault, profile);
+    fault->stats = index;
+}
+
+error_t set_fault_profile(assembly_line_t line, const fault_profile_t *profile) {
+    if (!profile) return INVALID_POINTER;
+    if (!valid_fault_profile(profile)) return PROFILE_ERROR;
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
+    set_fault_profile_locked(line, profile);
+    spin_mutex_unlock(&line->safe_mutex);
+    return OK;
+}
+
+error_t set_arm_fault_profile(assembly_line_t line, side_t side, unsigned int position, const fault_profile_t *profile) {
+    if (!profile) return INVALID_POINTER;
+    if (position == 0 || position > MAX_POSITION) return INCORRECT_POSITION;
+    if (!valid_fault_profile(profile)) return PROFILE_ERROR;
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
+    set_arm_fault_profile_locked(line, side, position, profile);
+    spin_mutex_unlock(&line->safe_mutex);
+    return OK;
+}
+
+error_t set_station_fault_profile(assembly_line_t line, unsigned int position, const fault_profile_t *profile) {
+    if (!profile) return INVALID_POINTER;
+    if (position == 0 || position > MAX_POSITION) return INCORRECT_POSITION;
+    if (!valid_fault_profile(profile)) return PROFILE_ERROR;
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
+    set_arm_fault_profile_locked(line, LEFT, position, profile);
+    set_arm_fault_profile_locked(line, RIGHT, position, profile);
+    spin_mutex_unlock(&line->safe_mutex);
+    return OK;
+}
+
+// Section du fichier de profils : line pour toute la ligne, sinon side -1
+// pour les deux côtés de la position
+typedef struct {
+    int line;
+    unsigned int position;
+    int side;
+    fault_profile_t profile;
+} profile_section_t;
+
+void apply_profile_section_locked(assembly_line_t line, const profile_section_t *section) {
+    if (section->line) {
+        set_fault_profile_locked(line, &section->profile);
+    } else if (section->side < 0) {
+        set_arm_fault_profile_locked(line, LEFT, section->position, &section->profile);
+        set_arm_fault_profile_locked(line, RIGHT, section->position, &section->profile);
+    } else {
+        set_arm_fault_profile_locked(line, section->side, section->position, &section->profile);
+    }
+}
+
+error_t check_profile_section(const profile_section_t *section) {
+    if (!section->line && (section->position == 0 || section->position > MAX_POSITION)) {
+        return INCORRECT_POSITION;
+    }
+    if (!valid_fault_profile(&section->profile)) return PROFILE_ERROR;
+    return OK;
+}
+
+error_t load_fault_profiles(assembly_line_t line, const char *path) {
+    if (!path) return INVALID_POINTER;
+    FILE *file = fopen(path, "r");
+    if (!file) return PROFILE_ERROR;
+    char buffer[256];
+    // Tout le fichier est lu et vérifié avant d'appliquer quoi que ce soit
+    profile_section_t sections[MAX_PROFILE_SECTIONS];
+    int count = 0;
+    error_t res = OK;
+    while (fgets(buffer, sizeof(buffer), file)) {
+        char *entry = trim(buffer);
+        if (*entry == '\0' || *entry == '#') continue;
+        if (*entry == '[') {
+            if (count > 0 && (res = check_profile_section(&sections[count-1])) != OK) {
+                goto parse_error;
+            }
+            if (count == MAX_PROFILE_SECTIONS) {
+                res = PROFILE_ERROR;
+                goto parse_error;
+            }
+            profile_section_t *section = &sections[count++];
+            if ((res = parse_profile_section(entry, &section->line, &section->position, &section->side)) != OK) {
+                goto parse_error;
+            }
+            default_fault_profile(&section->profile);
+            continue;
+        }
+        char *value = strchr(entry, '=');
+        if (count == 0 || !value) {
+            res = PROFILE_ERROR;
+            goto parse_error;
+        }
+        *value++ = '\0';
+        if ((res = parse_profile_entry(trim(entry), trim(value), &sections[count-1].profile)) != OK) {
+            goto parse_error;
+        }
+    }
+    if (count > 0 && (res = check_profile_section(&sections[count-1])) != OK) {
+        goto parse_error;
+    }
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
+    for (int i = 0; i < count; i++) {
+        apply_profile_section_locked(line, &sections[i]);
+    }
+    spin_mutex_unlock(&line->safe_mutex);
+parse_error:
+    fclose(file);
+    return res;
+}
+
+error_t register_thread_usage(assembly_line_t line, const char *name, int *slot) {
+    return add_usage_thread(&line->usage, name, 0, slot);
+}
+
+error_t register_task_usage(assembly_line_t line, const char *name, int *slot) {
+    return add_usage_thread(&line->usage, name, 1, slot);
+}
+
+void begin_thread_usage(assembly_line_t line, int slot) {
+    begin_usage(&line->usage, slot);
+}
+
+void sample_thread_usage(assembly_line_t line, int slot) {
+    sample_usage(&line->usage, slot);
+}
+
+void print_efficiency_report(assembly_line_t line) {
+    spin_mutex_lock(&line->safe_mutex, &line->control_lock_site);
+    unsigned long long int built_cars = line->stats.built_cars;
+    spin_mutex_unlock(&line->safe_mutex);
+    print_usage(&line->usage, built_cars);
+}
+
+void print_wait_stats(assembly_line_t line) {
+    print_wait_header();
+    print_wait_site(&line->belt_sem_site);
+    print_wait_site(&line->belt_lock_site);
+    print_wait_site(&line->arm_sem_site);
+    print_wait_site(&line->arm_lock_site);
+    print_wait_site(&line->control_lock_site);
 }
 
 // END ASSEMBLY LINE
+// BEGIN BATCH SELFTEST
+#ifdef BATCH_SELFTEST
+
+// Vérifie chaque noyau disponible contre install et check_car, puis compare
+// leur débit à la boucle voiture par voiture. Le premier argument fixe la
+// graine aléatoire pour rejouer un échec. Se compile seul :
+// gcc -DBATCH_SELFTEST assembly.c assembly_library.c -o batch_selftest -pthread -lrt -lm
+
+typedef struct {
+    const char *name;
+    install_word_t install_word;
+    check_word_t check_word;
+} batch_kernel_t;
+
+#define SELFTEST_ROUNDS 20
+#define SELFTEST_STEPS 16
+#define BENCH_SIZE 65536
+#define BENCH_STEPS 200
+
+static double selftest_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int mask_bit(const uint64_t *mask, size_t i) {
+    return (mask[i / BATCH_WORD] >> (i % BATCH_WORD)) & 1;
+}
+
+// Les bits des voitures de complément doivent rester à 0
+static int padding_clear(const uint64_t *mask, size_t size) {
+    size_t words = CAR_BATCH_MASK_WORDS(size);
+    if (size % BATCH_WORD == 0) return 1;
+    return (mask[words - 1] >> (size % BATCH_WORD)) == 0;
+}
+
+// Retourne le nombre de différences trouvées
+static int check_kernel(const batch_kernel_t *kernel, size_t size) {
+    car_batch_t batch;
+    if (init_car_batch(&batch, size) != OK) {
+        printf("%s: cannot allocate %zu cars\n", kernel->name, size);
+        return 1;
+    }
+    batch->install_word = kernel->install_word;
+    batch->check_word = kernel->check_word;
+    size_t words = CAR_BATCH_MASK_WORDS(size) ? CAR_BATCH_MASK_WORDS(size) : 1;
+    car_t *cars = calloc(size ? size : 1, sizeof(car_t));
+    uint64_t *failures = calloc(words, sizeof(uint64_t));
+    uint64_t *results = calloc(words, sizeof(uint64_t));
+    unsigned int *status = car_batch_status(batch);
+    int errors = 0;
+    if (!cars || !failures || !results) {
+        printf("%s: cannot allocate %zu cars\n", kernel->name, size);
+        errors = 1;
+        goto end;
+    }
+    for (int round = 0; round < SELFTEST_ROUNDS && !errors; round++) {
+        // Statuts au hasard, dont des voitures vides et complètes
+        for (size_t i = 0; i < size; i++) {
+            unsigned int s = rand() % 4 == 0 ? COMPLETE_STATUS : rand() & COMPLETE_STATUS;
+            status[i] = cars[i].status = rand() % 8 == 0 ? 0 : s;
+        }
+        for (int step = 0; step < SELFTEST_STEPS && !errors; step++) {
+            part_t part = rand() % NUM_PARTS; // PART_EMPTY compris
+            error_t res = install_car_batch(batch, part, failures);
+            int any = 0;
+            for (size_t i = 0; i < size; i++) {
+                int failed = install(&cars[i], part) != OK;
+                any |= failed;
+                if (failed != mask_bit(failures, i) || cars[i].status != status[i]) errors++;
+            }
+            if ((res != OK) != any || !padding_clear(failures, size)) errors++;
+            size_t completed = 0, expected = 0;
+            check_car_batch(batch, results, &completed);
+            for (size_t i = 0; i < size; i++) {
+                int complete = check_car(&cars[i]);
+                expected += complete;
+                if (complete != mask_bit(results, i)) errors++;
+            }
+            if (completed != expected || !padding_clear(results, size)) errors++;
+        }
+    }
+    printf("%-6s %6zu cars: %s\n", kernel->name, size, errors ? "MISMATCH" : "ok");
+end:
+    free(cars);
+    free(failures);
+    free(results);
+    free_car_batch(&batch);
+    return errors;
+}
+
+// Débit en millions de voitures traitées par seconde
+static double bench_kernel(const batch_kernel_t *kernel, uint64_t *failures) {
+    car_batch_t batch;
+    if (init_car_batch(&batch, BENCH_SIZE) != OK) return 0;
+    if (kernel) {
+        batch->install_word = kernel->install_word;
+        batch->check_word = kernel->check_word;
+    }
+    car_t *cars = calloc(BENCH_SIZE, sizeof(car_t));
+    if (!cars) {
+        free_car_batch(&batch);
+        return 0;
+    }
+    size_t built = 0;
+    double start = selftest_now();
+    for (int step = 0; step < BENCH_STEPS; step++) {
+        part_t part = step % NUM_PARTS;
+        if (kernel) {
+            install_car_batch(batch, part, failures);
+        } else {
+            for (size_t i = 0; i < BENCH_SIZE; i++) {
+                failures[i / BATCH_WORD] |= (uint64_t)(install(&cars[i], part) != OK) << (i % BATCH_WORD);
+            }
+        }
+        if (part != PART_EMPTY) continue;
+        if (kernel) {
+            size_t completed = 0;
+            check_car_batch(batch, NULL, &completed);
+            built += completed;
+            reset_car_batch(batch);
+        } else {
+            for (size_t i = 0; i < BENCH_SIZE; i++) {
+                built += check_car(&cars[i]);
+                init_car(&cars[i]);
+            }
+        }
+    }
+    double elapsed = selftest_now() - start;
+    free(cars);
+    free_car_batch(&batch);
+    // Toutes les parties sont installées dans l'ordre à chaque tour
+    if (built != (size_t)BENCH_SIZE * (BENCH_STEPS / NUM_PARTS)) return 0;
+    return (double)BENCH_SIZE * BENCH_STEPS / elapsed / 1e6;
+}
+
+int main(int argc, char **argv) {
+    batch_kernel_t kernels[3];
+    int count = 0;
+    kernels[count++] = (batch_kernel_t){"scalar", install_word_scalar, check_word_scalar};
+#ifdef BATCH_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels[count++] = (batch_kernel_t){"sse2", install_word_sse2, check_word_sse2};
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels[count++] = (batch_kernel_t){"avx2", install_word_avx2, check_word_avx2};
+    }
+#endif
+    const size_t sizes[] = {0, 1, 63, 64, 65, 4097};
+    int errors = 0;
+    unsigned int seed = argc > 1 ? (unsigned int)strtoul(argv[1], NULL, 10) : (unsigned int)time(NULL);
+    printf("seed %u\n", seed);
+    srand(seed);
+    for (int k = 0; k < count; k++) {
+        for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+            errors += check_kernel(&kernels[k], sizes[s]);
+        }
+    }
+
+    static uint64_t failures[CAR_BATCH_MASK_WORDS(BENCH_SIZE)];
+    double scalar = bench_kernel(NULL, failures);
+    printf("%-12s %8.1f Mcars/s\n", "car loop", scalar);
+    for (int k = 0; k < count; k++) {
+        double rate = bench_kernel(&kernels[k], failures);
+        if (rate == 0) errors++;
+        printf("%-12s %8.1f Mcars/s (x%.1f)\n", kernels[k].name, rate, scalar ? rate / scalar : 0);
+    }
+    if (errors) {
+        printf("FAILED: %d mismatches\n", errors);
+        return 1;
+    }
+    printf("All kernels match\n");
+    return 0;
+}
+
+#endif
+// END BATCH SELFTEST
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <stddef.h>
+#include <stdint.h>
+
 // Si clock_nanosleep n'est pas disponible (MacOS), décommenter la ligne suivante
 // #define MACOS_SLEEP
 
+// Décommenter la ligne suivante pour figer la topologie de line_topology.h à
+// la compilation (bras robots et dépendances deviennent des constantes)
+// #define STATIC_TOPOLOGY
+
+// Décommenter la ligne suivante pour mesurer les compteurs matériels
+// (perf_event_open, Linux) autour des sections critiques
+// #define PERF_COUNTERS
+
 // Commenter cette ligne pour retirer les couleurs
 #define COLOR_PRINT
 
@@ -25,6 +36,8 @@
 #define MIN_DELAY 50
 // Délai maximum pour une installation par un bras robot
 #define MAX_DELAY 300
+// Borne du délai maximum d'un profil de pannes
+#define MAX_FAULT_DELAY 60000 // ms
 
 // Nombre maximum de positions sur le tapis roulant
 #define MAX_POSITION (NUM_PARTS+1)
@@ -33,6 +46,14 @@
 // Sous la forme 1/ONE_IN_BLOCK_CHANCE
 #define ONE_IN_BLOCK_CHANCE 25
 
+// Nombre maximum de profils de pannes (par nom) dont les statistiques sont
+// conservées. Au delà, la plus ancienne entrée qui n'est plus utilisée par un
+// bras robot est réutilisée
+#define MAX_PROFILES 24
+
+// Nombre maximum de threads suivis par le rapport d'efficacité
+#define MAX_TRACKED_THREADS 32
+
 // Liste des erreurs pouvant être retournées par les différentes fonctions
 typedef enum {
     // Pas d'erreur
@@ -56,7 +77,11 @@ typedef enum {
     // La ligne de production est à l'arret
     LINE_STOPPED = 9,
     // Pointeur invalide
-    INVALID_POINTER = 10
+    INVALID_POINTER = 10,
+    // Plus de place pour suivre un nouveau thread
+    TOO_MANY_THREADS = 11,
+    // Profil de pannes invalide ou illisible
+    PROFILE_ERROR = 12
 } error_t;
 
 // Liste des parties de la voiture à installer
@@ -85,6 +110,47 @@ typedef enum {
     RIGHT=1,
 } side_t;
 
+// Lois de probabilité du délai d'installation
+typedef enum {
+    // Uniforme entre min_delay et max_delay
+    DELAY_UNIFORM = 0,
+    // Pareto (queue lourde) à partir de min_delay, tronquée à max_delay
+    DELAY_PARETO = 1
+} delay_law_t;
+
+// Profil de latence et de pannes d'un bras robot. Les temps sont en ms et
+// comptés à partir de l'application du profil. Un profil est valide si
+// min_delay <= max_delay <= MAX_FAULT_DELAY et si une rafale ou une panne
+// périodique ne dure pas plus que sa période.
+typedef struct {
+    // Nom affiché dans les statistiques
+    char name[32];
+    // Délai d'installation
+    delay_law_t delay_law;
+    unsigned int min_delay;
+    unsigned int max_delay;
+    // Paramètre de forme de la loi de Pareto (plus il est petit, plus la
+    // queue est lourde)
+    double pareto_alpha;
+    // Probabilité de blocage 1/one_in_block_chance (0 pour jamais)
+    unsigned int one_in_block_chance;
+    // Si ramp_duration n'est pas nul, la probabilité de blocage évolue
+    // linéairement jusqu'à 1/ramp_one_in_block_chance en ramp_duration ms
+    unsigned int ramp_one_in_block_chance;
+    unsigned int ramp_duration;
+    // Rafales : toutes les burst_period ms, pendant burst_length ms, la
+    // probabilité de blocage est au moins 1/burst_one_in_block_chance
+    unsigned int burst_period;
+    unsigned int burst_length;
+    unsigned int burst_one_in_block_chance;
+    // Panne programmée : à partir de outage_start ms et pendant outage_length
+    // ms, le bras bloque toujours. Répétée toutes les outage_period ms si non
+    // nul
+    unsigned int outage_start;
+    unsigned int outage_length;
+    unsigned int outage_period;
+} fault_profile_t;
+
 // Type à utiliser pour la ligne d'assemblage
 typedef struct assembly_line *assembly_line_t;
 
@@ -96,7 +162,8 @@ typedef struct assembly_line *assembly_line_t;
  * @return un code d'erreur :
  *     - OK si tout s'est bien passé
  *     - MALLOC_ERROR si la mémoire n'a pas pu être allouée
- *     - SEM_ERROR si la création des sémaphores a echoué
+ *     - SEM_ERROR si le mutex du suivi CPU n'a pas pu être créé (les
+ *       sémaphores et mutex de la ligne eux-mêmes ne peuvent pas échouer)
  */
 error_t init_assembly_line(assembly_line_t *line);
 
@@ -106,13 +173,16 @@ error_t init_assembly_line(assembly_line_t *line);
  * @param line un pointeur vers une valeur de type assembly_line_t
  * @return un code d'erreur :
  *     - OK si tout s'est bien passé
- *     - SEM_ERROR si la destruction des sémaphores a echoué
+ *     - SEM_ERROR si le mutex du suivi CPU n'a pas pu être détruit
  */
 error_t free_assembly_line(assembly_line_t *line);
 
 /**
 * Configure un bras robot qui installe la partie donnée du côté side à la
 * position donée.
+*
+* Avec STATIC_TOPOLOGY, les bras robots sont ceux de line_topology.h : seul un
+* bras déjà présent dans la topologie est accepté.
 * @param line la ligne d'assemblage
 * @param part la partie de la voiture
 * @param side le côté de la ligne d'assemblage (on peut avoir jusqu'à un bras de
@@ -123,7 +193,8 @@ error_t free_assembly_line(assembly_line_t *line);
 *     - OK si tout s'est bien passé
 *     - LINE_STARTED si la ligne d'assemblage est en cours de fonctionnement
 *     - INCORRECT_POSITION si la position est incorrecte
-*     - NON_EMPTY_POSITION si la position est déjà occupée
+*     - NON_EMPTY_POSITION si la position est déjà occupée (par une autre
+*       partie avec STATIC_TOPOLOGY)
 */
 error_t setup_arm(assembly_line_t line, part_t part, side_t side, unsigned int position);
 
@@ -186,6 +257,261 @@ error_t shutdown_assembly(assembly_line_t line);
 /**
  * Affiche les statistiques de la ligne d'assemblage.
  *
+ * Si PERF_COUNTERS est défini, affiche aussi les compteurs matériels (cycles,
+ * instructions, défauts de cache, erreurs de prédiction de branchement et
+ * changements de contexte) par appel de trigger_arm, d'itération du tapis
+ * roulant, de handle_belt_position et de print_assembly_stats, ainsi que par
+ * bras robot pour trigger_arm.
+ *
  * @param line la ligne d'assemblage
  */
 void print_assembly_stats(assembly_line_t line);
+
+/**
+ * Remplit un profil de pannes avec le comportement par défaut : délai uniforme
+ * entre MIN_DELAY et MAX_DELAY et blocage avec une probabilité
+ * 1/ONE_IN_BLOCK_CHANCE.
+ *
+ * @param profile le profil à remplir
+ */
+void default_fault_profile(fault_profile_t *profile);
+
+/**
+ * Applique un profil de pannes à tous les bras robots de la ligne. Les
+ * voitures produites et le temps de fonctionnement sont ensuite comptés pour
+ * ce profil, ainsi que les blocages et reprises des bras qui l'utilisent.
+ * Peut être appelé pendant le fonctionnement de la ligne.
+ *
+ * @param line la ligne d'assemblage
+ * @param profile le profil à appliquer
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si profile est NULL
+ *     - PROFILE_ERROR si le profil est invalide
+ */
+error_t set_fault_profile(assembly_line_t line, const fault_profile_t *profile);
+
+/**
+ * Applique un profil de pannes aux deux bras robots d'une position. Les
+ * blocages et reprises de ces bras sont ensuite comptés pour ce profil.
+ *
+ * @param line la ligne d'assemblage
+ * @param position la position sur la ligne (entre 1 et MAX_POSITION)
+ * @param profile le profil à appliquer
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si profile est NULL
+ *     - INCORRECT_POSITION si la position est incorrecte
+ *     - PROFILE_ERROR si le profil est invalide
+ */
+error_t set_station_fault_profile(assembly_line_t line, unsigned int position, const fault_profile_t *profile);
+
+/**
+ * Applique un profil de pannes à un seul bras robot. Ses blocages et reprises
+ * sont ensuite comptés pour ce profil.
+ *
+ * @param line la ligne d'assemblage
+ * @param side le côté où se trouve le bras robot
+ * @param position la position du bras robot (entre 1 et MAX_POSITION)
+ * @param profile le profil à appliquer
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si profile est NULL
+ *     - INCORRECT_POSITION si la position est incorrecte
+ *     - PROFILE_ERROR si le profil est invalide
+ */
+error_t set_arm_fault_profile(assembly_line_t line, side_t side, unsigned int position, const fault_profile_t *profile);
+
+/**
+ * Charge des profils de pannes depuis un fichier et les applique à la ligne.
+ *
+ * Le fichier contient des sections "[line]", "[station <position>]" ou
+ * "[arm <left|right> <position>]" suivies de lignes "clé = valeur" reprenant
+ * les champs de fault_profile_t (delay_law vaut "uniform" ou "pareto"). Les
+ * valeurs entières sont écrites en base 10 sans signe ni unité, pareto_alpha
+ * est un réel fini.
+ * Chaque section part du profil par défaut et est appliquée dans l'ordre du
+ * fichier : une section "[line]" remplace les profils de tous les bras, elle
+ * doit donc précéder les autres. Les lignes vides et celles commençant par '#'
+ * sont ignorées. Le fichier entier est vérifié avant d'être appliqué : en cas
+ * d'erreur, aucun profil n'est modifié.
+ *
+ * @param line la ligne d'assemblage
+ * @param path le chemin du fichier
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si path est NULL
+ *     - PROFILE_ERROR si le fichier est illisible ou invalide
+ *     - INCORRECT_POSITION si une position est incorrecte
+ */
+error_t load_fault_profiles(assembly_line_t line, const char *path);
+
+/**
+ * Enregistre un thread dont la consommation CPU sera suivie dans le rapport
+ * d'efficacité de la ligne d'assemblage. Le thread "belt" (boucle de
+ * run_assembly) est enregistré automatiquement.
+ *
+ * @param line la ligne d'assemblage
+ * @param name le nom affiché dans le rapport (copié, tronqué à 31 caractères)
+ * @param slot l'identifiant à utiliser pour les mesures
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si name ou slot est NULL
+ *     - TOO_MANY_THREADS s'il y a déjà MAX_TRACKED_THREADS threads suivis. Le
+ *       rapport d'efficacité signale alors que ses totaux sont incomplets
+ */
+error_t register_thread_usage(assembly_line_t line, const char *name, int *slot);
+
+/**
+ * Enregistre une tâche (par exemple un bras robot) exécutée par des threads
+ * déjà suivis. Elle est mesurée avec begin_thread_usage et
+ * sample_thread_usage autour de chaque exécution, apparaît dans le rapport
+ * mais n'est pas comptée dans les totaux.
+ *
+ * @param line la ligne d'assemblage
+ * @param name le nom affiché dans le rapport (copié, tronqué à 31 caractères)
+ * @param slot l'identifiant à utiliser pour les mesures
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si name ou slot est NULL
+ *     - TOO_MANY_THREADS s'il y a déjà MAX_TRACKED_THREADS threads suivis. Le
+ *       rapport d'efficacité signale alors que ses totaux sont incomplets
+ */
+error_t register_task_usage(assembly_line_t line, const char *name, int *slot);
+
+/**
+ * Démarre une mesure de la consommation du thread appelant : temps CPU
+ * (CLOCK_THREAD_CPUTIME_ID), temps écoulé et changements de contexte.
+ *
+ * @param line la ligne d'assemblage
+ * @param slot l'identifiant retourné par register_thread_usage
+ */
+void begin_thread_usage(assembly_line_t line, int slot);
+
+/**
+ * Ajoute au suivi la consommation du thread appelant depuis le dernier appel à
+ * begin_thread_usage ou sample_thread_usage, puis redémarre la mesure.
+ *
+ * @param line la ligne d'assemblage
+ * @param slot l'identifiant retourné par register_thread_usage
+ */
+void sample_thread_usage(assembly_line_t line, int slot);
+
+/**
+ * Affiche le rapport d'efficacité de la ligne d'assemblage : temps CPU,
+ * temps actif et bloqué et changements de contexte de chaque thread suivi,
+ * temps CPU par voiture construite et fraction d'inactivité.
+ *
+ * @param line la ligne d'assemblage
+ */
+void print_efficiency_report(assembly_line_t line);
+
+/**
+ * Affiche, pour chaque attente du tapis roulant et des bras robots, le nombre
+ * d'attentes et comment elles se sont terminées (immédiatement, en attente
+ * active, en cédant le processeur ou après une mise en sommeil), la latence
+ * moyenne entre la libération et la reprise, le coût CPU moyen et le budget
+ * d'attente active courant.
+ *
+ * @param line la ligne d'assemblage
+ */
+void print_wait_stats(assembly_line_t line);
+
+
+// Nombre de mots de 64 bits nécessaires pour un masque de n voitures
+#define CAR_BATCH_MASK_WORDS(n) (((n) + 63) / 64)
+
+// Type à utiliser pour un lot de voitures (simulation en masse)
+typedef struct car_batch *car_batch_t;
+
+/**
+ * Initialise et alloue dynamiquement un lot de voitures indépendantes.
+ *
+ * Les statuts des voitures sont rangés de façon contiguë (structure de
+ * tableaux) pour être traités par des instructions SIMD. Toutes les voitures
+ * sont initialisées vides.
+ *
+ * @param batch un pointeur vers une valeur de type car_batch_t
+ * @param size le nombre de voitures du lot
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si batch est NULL
+ *     - MALLOC_ERROR si la mémoire n'a pas pu être allouée
+ */
+error_t init_car_batch(car_batch_t *batch, size_t size);
+
+/**
+ * Libère les ressources utilisées par le lot de voitures.
+ *
+ * @param batch un pointeur vers une valeur de type car_batch_t
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ */
+error_t free_car_batch(car_batch_t *batch);
+
+/**
+ * Remet toutes les voitures du lot à zéro (aucune partie installée).
+ *
+ * @param batch le lot de voitures
+ */
+void reset_car_batch(car_batch_t batch);
+
+/**
+ * Donne accès aux statuts (masques des parties installées) des voitures du
+ * lot. Le tableau contient car_batch_size(batch) éléments.
+ *
+ * @param batch le lot de voitures
+ *
+ * @return le tableau des statuts, NULL si batch est NULL
+ */
+unsigned int *car_batch_status(car_batch_t batch);
+
+/**
+ * @param batch le lot de voitures
+ *
+ * @return le nombre de voitures du lot
+ */
+size_t car_batch_size(car_batch_t batch);
+
+/**
+ * Installe la partie donnée sur toutes les voitures du lot, avec les mêmes
+ * règles que pour une voiture seule : une voiture dont les dépendances ne sont
+ * pas satisfaites n'est pas modifiée.
+ *
+ * Les masques contiennent un bit par voiture : le bit (i % 64) du mot (i / 64)
+ * correspond à la voiture i. Ils doivent contenir au moins
+ * CAR_BATCH_MASK_WORDS(car_batch_size(batch)) mots.
+ *
+ * @param batch le lot de voitures
+ * @param part la partie à installer
+ * @param failures masque des voitures dont les dépendances n'étaient pas
+ * satisfaites (peut être NULL)
+ *
+ * @return un code d'erreur :
+ *     - OK si la partie a été installée sur toutes les voitures
+ *     - INVALID_POINTER si batch est NULL
+ *     - INSTALL_REQUIREMENTS si au moins une voiture n'a pas pu être modifiée
+ */
+error_t install_car_batch(car_batch_t batch, part_t part, uint64_t *failures);
+
+/**
+ * Vérifie si les voitures du lot sont complètes.
+ *
+ * @param batch le lot de voitures
+ * @param results masque des voitures complètes (peut être NULL), même format
+ * que pour install_car_batch
+ * @param completed nombre de voitures complètes (peut être NULL)
+ *
+ * @return un code d'erreur :
+ *     - OK si tout s'est bien passé
+ *     - INVALID_POINTER si batch est NULL
+ */
+error_t check_car_batch(car_batch_t batch, uint64_t *results, size_t *completed);
@@ -4,6 +4,15 @@
 #include <time.h>
 #include <errno.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
 
 // Signal
 void handle_signal(int signum, void (*handler)(int)) {
@@ -59,4 +68,425 @@ void delay_until(const struct timespec *start, unsigned long long int delay) {
     struct timespec end;
     add_to_time(&end, delay, start);
     while (clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &end, NULL) == EINTR) {}
-}
\ No newline at end of file
+}
+
+// Pool
+// Each worker owns a heap of tasks sorted by deadline. An idle worker sleeps
+// until its next deadline, or the next deadline of a busy worker, and steals
+// due tasks from busy workers.
+struct pool_worker {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    pool_task_t **heap;
+    int size;
+    unsigned int wake_seq;
+    atomic_int busy;
+    atomic_int idle;
+    pthread_t thread;
+    struct pool *pool;
+    int id;
+};
+
+struct pool {
+    struct pool_worker *workers;
+    int count; // set before any worker starts
+    int started;
+    int capacity;
+    atomic_int tasks; // submitted tasks that have not stopped yet
+    atomic_uint next;
+    atomic_int stop;
+};
+
+static __thread int current_worker = -1;
+
+static unsigned long long int monotonic_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void heap_push(struct pool_worker *w, pool_task_t *task) {
+    int i = w->size++;
+    while (i > 0 && w->heap[(i-1)/2]->deadline > task->deadline) {
+        w->heap[i] = w->heap[(i-1)/2];
+        i = (i-1)/2;
+    }
+    w->heap[i] = task;
+}
+
+static pool_task_t *heap_pop(struct pool_worker *w) {
+    pool_task_t *top = w->heap[0];
+    pool_task_t *last = w->heap[--w->size];
+    int i = 0;
+    while (2*i+1 < w->size) {
+        int child = 2*i+1;
+        if (child+1 < w->size && w->heap[child+1]->deadline < w->heap[child]->deadline) child++;
+        if (last->deadline <= w->heap[child]->deadline) break;
+        w->heap[i] = w->heap[child];
+        i = child;
+    }
+    w->heap[i] = last;
+    return top;
+}
+
+// Sets *more if another task of w is already due
+static pool_task_t *pool_pop_due(struct pool_worker *w, unsigned long long int now, int try, int *more) {
+    pool_task_t *task = NULL;
+    if (try) {
+        *more = 0;
+        if (pthread_mutex_trylock(&w->mutex) != 0) return NULL;
+    } else {
+        pthread_mutex_lock(&w->mutex);
+    }
+    if (w->size > 0 && w->heap[0]->deadline <= now) task = heap_pop(w);
+    *more = w->size > 0 && w->heap[0]->deadline <= now;
+    pthread_mutex_unlock(&w->mutex);
+    return task;
+}
+
+static void pool_wake(struct pool_worker *w) {
+    pthread_mutex_lock(&w->mutex);
+    w->wake_seq++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// Wakes up one idle worker so that it watches the tasks of a busy worker
+static void pool_notify_idle(struct pool *pool, struct pool_worker *self) {
+    for (int i = 1; i < pool->count; i++) {
+        struct pool_worker *other = &pool->workers[(self->id + i) % pool->count];
+        if (other->idle) {
+            pool_wake(other);
+            return;
+        }
+    }
+}
+
+static void pool_run(struct pool *pool, struct pool_worker *self, pool_task_t *task) {
+    unsigned long long int start = monotonic_now();
+    self->busy = 1;
+    // an idle worker now watches the heap of this busy worker
+    pool_notify_idle(pool, self);
+    int again = task->run(task);
+    self->busy = 0;
+    if (!again) pool->tasks--;
+    if (!again || pool->stop) return; // the task may be reused by its owner
+    task->deadline = start + task->period * 1000000;
+    pthread_mutex_lock(&self->mutex);
+    heap_push(self, task);
+    pthread_mutex_unlock(&self->mutex);
+}
+
+static void pool_sleep(struct pool *pool, struct pool_worker *self) {
+    unsigned long long int wake = ULLONG_MAX;
+    self->idle = 1;
+    pthread_mutex_lock(&self->mutex);
+    unsigned int seq = self->wake_seq;
+    pthread_mutex_unlock(&self->mutex);
+    for (int i = 1; i < pool->count; i++) {
+        struct pool_worker *other = &pool->workers[(self->id + i) % pool->count];
+        if (!other->busy) continue;
+        pthread_mutex_lock(&other->mutex);
+        if (other->size > 0 && other->heap[0]->deadline < wake) wake = other->heap[0]->deadline;
+        pthread_mutex_unlock(&other->mutex);
+    }
+    pthread_mutex_lock(&self->mutex);
+    if (self->size > 0 && self->heap[0]->deadline < wake) wake = self->heap[0]->deadline;
+    if (seq == self->wake_seq && !pool->stop && wake > monotonic_now()) {
+        if (wake == ULLONG_MAX) {
+            pthread_cond_wait(&self->cond, &self->mutex);
+        } else {
+            struct timespec ts;
+            ts.tv_sec = wake / 1000000000;
+            ts.tv_nsec = wake % 1000000000;
+            pthread_cond_timedwait(&self->cond, &self->mutex, &ts);
+        }
+    }
+    pthread_mutex_unlock(&self->mutex);
+    self->idle = 0;
+}
+
+static void *pool_worker_loop(void *arg) {
+    struct pool_worker *self = arg;
+    struct pool *pool = self->pool;
+    current_worker = self->id;
+    while (!pool->stop) {
+        unsigned long long int now = monotonic_now();
+        int more = 0;
+        pool_task_t *task = pool_pop_due(self, now, 0, &more);
+        for (int i = 1; !task && i < pool->count; i++) { // steal from busy workers
+            struct pool_worker *other = &pool->workers[(self->id + i) % pool->count];
+            if (other->busy) task = pool_pop_due(other, now, 1, &more);
+        }
+        if (more) pool_notify_idle(pool, self); // another due task is waiting
+        if (task) {
+            pool_run(pool, self, task);
+        } else {
+            pool_sleep(pool, self);
+        }
+    }
+    return NULL;
+}
+
+int pool_create(pool_t *pool, int workers, int capacity) {
+    if (workers <= 0) workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    if (workers <= 0) workers = 1;
+    struct pool *inner = calloc(1, sizeof(struct pool));
+    if (inner == NULL) return -1;
+    inner->workers = calloc(workers, sizeof(struct pool_worker));
+    if (inner->workers == NULL) goto error;
+    inner->capacity = capacity;
+    for (int i = 0; i < workers; i++) {
+        // a stolen task is pushed on the heap of its thief, so any heap may
+        // hold every task of the pool
+        inner->workers[i].heap = malloc(capacity * sizeof(pool_task_t *));
+        if (inner->workers[i].heap == NULL) goto heap_error;
+    }
+    // every worker is set up before the first one starts and scans the others
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    for (int i = 0; i < workers; i++) {
+        struct pool_worker *w = &inner->workers[i];
+        w->pool = inner;
+        w->id = i;
+        pthread_mutex_init(&w->mutex, NULL);
+        pthread_cond_init(&w->cond, &attr);
+    }
+    pthread_condattr_destroy(&attr);
+    inner->count = workers;
+    for (; inner->started < workers; inner->started++) {
+        struct pool_worker *w = &inner->workers[inner->started];
+        if (pthread_create(&w->thread, NULL, pool_worker_loop, w) != 0) {
+            pool_destroy(&inner);
+            return -1;
+        }
+    }
+    *pool = inner;
+    return 0;
+heap_error:
+    for (int i = 0; i < workers; i++) {
+        free(inner->workers[i].heap);
+    }
+    free(inner->workers);
+error:
+    free(inner);
+    return -1;
+}
+
+int pool_submit(pool_t pool, pool_task_t *task, unsigned long long int delay) {
+    if (pool->tasks++ >= pool->capacity) {
+        pool->tasks--;
+        return -1;
+    }
+    struct pool_worker *w = &pool->workers[pool->next++ % pool->count];
+    task->deadline = monotonic_now() + delay * 1000000;
+    pthread_mutex_lock(&w->mutex);
+    heap_push(w, task);
+    w->wake_seq++;
+    pthread_cond_signal(&w->cond);
+    pthread_mutex_unlock(&w->mutex);
+    return 0;
+}
+
+int pool_size(pool_t pool) {
+    return pool->count;
+}
+
+int pool_current_worker() {
+    return current_worker;
+}
+
+void pool_destroy(pool_t *pool) {
+    if (pool == NULL || *pool == NULL) return;
+    struct pool *inner = *pool;
+    inner->stop = 1;
+    for (int i = 0; i < inner->started; i++) {
+        pool_wake(&inner->workers[i]);
+    }
+    for (int i = 0; i < inner->count; i++) {
+        struct pool_worker *w = &inner->workers[i];
+        if (i < inner->started) pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->mutex);
+        pthread_cond_destroy(&w->cond);
+        free(w->heap);
+    }
+    free(inner->workers);
+    free(inner);
+    *pool = NULL;
+}
+
+// Adaptive wait
+enum { WAIT_FAST, WAIT_SPUN, WAIT_YIELDED, WAIT_PARKED };
+
+static inline void cpu_relax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+static void futex_wait(atomic_int *addr, int value) {
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, value, NULL, NULL, 0);
+#else
+    struct timespec ts = {0, 50000};
+    if (atomic_load(addr) == value) nanosleep(&ts, NULL);
+#endif
+}
+
+static void futex_wake(atomic_int *addr) {
+#ifdef __linux__
+    syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+#else
+    (void)addr;
+#endif
+}
+
+static unsigned long long int thread_cpu_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (unsigned long long int)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Records a slow wait and moves the spin budget of the site
+static void wait_site_update(wait_site_t *site, int how, unsigned long long int start,
+                             unsigned long long int cpu_start, unsigned long long int release,
+                             unsigned int spins) {
+    unsigned long long int end = monotonic_now();
+    site->waits++;
+    site->cpu_ns += thread_cpu_now() - cpu_start;
+    if (release >= start && release <= end) site->latency_ns += end - release;
+    unsigned int budget = site->spin;
+    unsigned int target;
+    if (how == WAIT_SPUN) {
+        site->spun++;
+        target = 2 * spins + WAIT_SPIN_MIN;
+    } else {
+        if (how == WAIT_YIELDED) site->yielded++;
+        else site->parked++;
+        // a short wait should have been spun, a long one should park sooner
+        target = end - start < WAIT_PARK_COST ? 2 * budget : budget / 2;
+    }
+    budget = budget + ((int)target - (int)budget) / 8;
+    if (budget < WAIT_SPIN_MIN) budget = WAIT_SPIN_MIN;
+    if (budget > WAIT_SPIN_MAX) budget = WAIT_SPIN_MAX;
+    site->spin = budget;
+}
+
+void spin_sem_init(spin_sem_t *sem, int value) {
+    sem->value = value;
+    sem->waiters = 0;
+    sem->post_ns = 0;
+}
+
+void spin_sem_post(spin_sem_t *sem) {
+    sem->post_ns = monotonic_now();
+    sem->value++;
+    if (sem->waiters > 0) futex_wake(&sem->value);
+}
+
+static int spin_sem_trywait(spin_sem_t *sem) {
+    int value = sem->value;
+    while (value > 0) {
+        if (atomic_compare_exchange_weak(&sem->value, &value, value - 1)) return 1;
+    }
+    return 0;
+}
+
+void spin_sem_wait(spin_sem_t *sem, wait_site_t *site) {
+    if (spin_sem_trywait(sem)) {
+        site->waits++;
+        return;
+    }
+    unsigned long long int start = monotonic_now(), cpu_start = thread_cpu_now();
+    unsigned int budget = site->spin;
+    for (unsigned int i = 0; i < budget; i++) {
+        cpu_relax();
+        if (sem->value > 0 && spin_sem_trywait(sem)) {
+            wait_site_update(site, WAIT_SPUN, start, cpu_start, sem->post_ns, i);
+            return;
+        }
+    }
+    for (int i = 0; i < WAIT_YIELDS; i++) {
+        sched_yield();
+        if (spin_sem_trywait(sem)) {
+            wait_site_update(site, WAIT_YIELDED, start, cpu_start, sem->post_ns, budget);
+            return;
+        }
+    }
+    sem->waiters++;
+    while (!spin_sem_trywait(sem)) {
+        futex_wait(&sem->value, 0);
+    }
+    sem->waiters--;
+    wait_site_update(site, WAIT_PARKED, start, cpu_start, sem->post_ns, budget);
+}
+
+int spin_sem_getvalue(spin_sem_t *sem) {
+    return sem->value;
+}
+
+void spin_mutex_init(spin_mutex_t *mutex) {
+    mutex->state = 0;
+    mutex->unlock_ns = 0;
+}
+
+void spin_mutex_lock(spin_mutex_t *mutex, wait_site_t *site) {
+    int expected = 0;
+    if (atomic_compare_exchange_strong(&mutex->state, &expected, 1)) {
+        site->waits++;
+        return;
+    }
+    unsigned long long int start = monotonic_now(), cpu_start = thread_cpu_now();
+    unsigned int budget = site->spin;
+    for (unsigned int i = 0; i < budget; i++) {
+        cpu_relax();
+        expected = 0;
+        if (mutex->state == 0 && atomic_compare_exchange_strong(&mutex->state, &expected, 1)) {
+            wait_site_update(site, WAIT_SPUN, start, cpu_start, mutex->unlock_ns, i);
+            return;
+        }
+    }
+    for (int i = 0; i < WAIT_YIELDS; i++) {
+        sched_yield();
+        expected = 0;
+        if (atomic_compare_exchange_strong(&mutex->state, &expected, 1)) {
+            wait_site_update(site, WAIT_YIELDED, start, cpu_start, mutex->unlock_ns, budget);
+            return;
+        }
+    }
+    // the state stays 2 while anybody may be parked
+    while (atomic_exchange(&mutex->state, 2) != 0) {
+        futex_wait(&mutex->state, 2);
+    }
+    wait_site_update(site, WAIT_PARKED, start, cpu_start, mutex->unlock_ns, budget);
+}
+
+void spin_mutex_unlock(spin_mutex_t *mutex) {
+    mutex->unlock_ns = monotonic_now();
+    if (atomic_fetch_sub(&mutex->state, 1) != 1) {
+        mutex->state = 0;
+        futex_wake(&mutex->state);
+    }
+}
+
+void print_wait_header() {
+    printf("%-14s %8s %8s %8s %8s %8s %12s %12s %6s\n", "Wait site", "Waits", "Free",
+           "Spun", "Yielded", "Parked", "Latency (us)", "CPU (us)", "Spin");
+}
+
+void print_wait_site(wait_site_t *site) {
+    unsigned long long int waits = site->waits;
+    unsigned long long int slow = site->spun + site->yielded + site->parked;
+    printf("%-14s %8llu %8llu %8llu %8llu %8llu", site->name, waits,
+           waits - slow, (unsigned long long int)site->spun,
+           (unsigned long long int)site->yielded, (unsigned long long int)site->parked);
+    if (slow) {
+        printf(" %12.1f %12.1f", site->latency_ns / 1e3 / slow, site->cpu_ns / 1e3 / slow);
+    } else {
+        printf(" %12s %12s", "-", "-");
+    }
+    printf(" %6u\n", (unsigned int)site->spin);
+}
@@ -2,6 +2,7 @@
 
 #include <signal.h>
 #include <time.h>
+#include <stdatomic.h>
 
 // Signal
 void handle_signal(int signum, void (*handler)(int));
@@ -13,4 +14,60 @@ void pet_watchdog(timer_t timer_id, int duration);
 
 // delay
 void add_to_time(struct timespec *t, unsigned long long int delay, const struct timespec *start);
-void delay_until(const struct timespec *start, unsigned long long int delay);
\ No newline at end of file
+void delay_until(const struct timespec *start, unsigned long long int delay);
+
+// Pool
+typedef struct pool *pool_t;
+typedef struct pool_task {
+    int (*run)(struct pool_task *task); // returns 0 to stop, otherwise runs again after period
+    void *arg;
+    unsigned long long int period; // ms
+    unsigned long long int deadline; // ns (CLOCK_MONOTONIC), set by the pool
+} pool_task_t;
+// workers <= 0 uses one worker per online core. capacity is the maximum number
+// of tasks in the whole pool: a task counts from its submit until its run
+// returns 0. Returns 0 on success, -1 on failure.
+int pool_create(pool_t *pool, int workers, int capacity);
+// Returns -1 if the pool already holds capacity tasks
+int pool_submit(pool_t pool, pool_task_t *task, unsigned long long int delay);
+int pool_size(pool_t pool);
+int pool_current_worker();
+void pool_destroy(pool_t *pool);
+
+// Adaptive wait
+// Waits spin with a pause instruction, then yield, then park on a futex. The
+// spin budget of each wait site adapts to the waits observed at this site.
+#define WAIT_SPIN_INIT 128
+#define WAIT_SPIN_MIN 16
+#define WAIT_SPIN_MAX 8192
+#define WAIT_YIELDS 4
+#define WAIT_PARK_COST 20000 // ns, waits shorter than this should not park
+typedef struct {
+    const char *name;
+    atomic_uint spin; // current spin budget (pause iterations)
+    atomic_ullong waits; // all acquisitions
+    atomic_ullong spun; // acquired while spinning
+    atomic_ullong yielded; // acquired while yielding
+    atomic_ullong parked; // acquired after parking
+    atomic_ullong latency_ns; // release -> acquire, for waits that did not get it at once
+    atomic_ullong cpu_ns; // cpu time spent waiting
+} wait_site_t;
+#define WAIT_SITE(site_name) { .name = site_name, .spin = WAIT_SPIN_INIT }
+typedef struct {
+    atomic_int value;
+    atomic_int waiters;
+    atomic_ullong post_ns;
+} spin_sem_t;
+typedef struct {
+    atomic_int state; // 0: unlocked, 1: locked, 2: locked with waiters
+    atomic_ullong unlock_ns;
+} spin_mutex_t;
+void spin_sem_init(spin_sem_t *sem, int value);
+void spin_sem_post(spin_sem_t *sem);
+void spin_sem_wait(spin_sem_t *sem, wait_site_t *site);
+int spin_sem_getvalue(spin_sem_t *sem);
+void spin_mutex_init(spin_mutex_t *mutex);
+void spin_mutex_lock(spin_mutex_t *mutex, wait_site_t *site);
+void spin_mutex_unlock(spin_mutex_t *mutex);
+void print_wait_header();
+void print_wait_site(wait_site_t *site);
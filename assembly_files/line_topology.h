@@ -0,0 +1,83 @@
+#pragma once
+
+#include "assembly.h"
+
+// Topologie de la ligne d'assemblage, déclarée une seule fois sous forme de
+// X-macros. Les tables de dépendances, la table des bras robots de main.c et
+// les vérifications statiques en sont dérivées. Avec STATIC_TOPOLOGY, la
+// recherche du bras et les masques de dépendances deviennent des constantes.
+
+// Masque d'une partie dans le statut d'une voiture
+#define PART_FLAG(part) (1u << (part))
+
+// Graphe des parties : PART(x, partie, parties requises)
+#define LINE_PARTS(PART, x) \
+    PART(x, PART_FRAME, 0) \
+    PART(x, PART_ENGINE, PART_FLAG(PART_FRAME)) \
+    PART(x, PART_WHEELS, PART_FLAG(PART_FRAME)) \
+    PART(x, PART_BODY, PART_FLAG(PART_ENGINE)) \
+    PART(x, PART_DOORS, PART_FLAG(PART_BODY)) \
+    PART(x, PART_WINDOWS, PART_FLAG(PART_DOORS)) \
+    PART(x, PART_LIGHTS, PART_FLAG(PART_BODY))
+
+// Disposition des bras robots : ARM(x, partie, côté, position)
+#define LINE_ARMS(ARM, x) \
+    ARM(x, PART_FRAME, LEFT, 1) \
+    ARM(x, PART_ENGINE, LEFT, 2) \
+    ARM(x, PART_WHEELS, RIGHT, 2) \
+    ARM(x, PART_BODY, LEFT, 3) \
+    ARM(x, PART_DOORS, RIGHT, 4) \
+    ARM(x, PART_LIGHTS, LEFT, 4) \
+    ARM(x, PART_WINDOWS, RIGHT, 5)
+
+// BEGIN DERIVED
+
+#define TOPO_REQUIREMENTS_OF(x, part, req) | ((x) == (part) ? (req) : 0)
+#define TOPO_FLAG_OF(x, part, req) | PART_FLAG(part)
+#define TOPO_COUNT_ARM(x, part, side, position) + 1
+#define TOPO_INSTALLED_BEFORE(x, part, side, position) | ((position) < (x) ? PART_FLAG(part) : 0)
+#define TOPO_REQUIRED_AT(x, part, side, position) | ((position) == (x) ? PART_REQUIREMENTS(part) : 0)
+#define TOPO_POSITION_FLAG(x, part, side, position) | (1u << (position))
+#define TOPO_COUNT_LEFT(x, part, side, position) + ((position) == (x) && (side) == LEFT)
+#define TOPO_COUNT_RIGHT(x, part, side, position) + ((position) == (x) && (side) == RIGHT)
+#define TOPO_OUT_OF_RANGE(x, part, side, position) + ((position) < 1 || (position) > MAX_POSITION)
+
+// Parties requises pour installer part
+#define PART_REQUIREMENTS(part) (0 LINE_PARTS(TOPO_REQUIREMENTS_OF, part))
+// Statut d'une voiture complète
+#define LINE_COMPLETE_STATUS (0 LINE_PARTS(TOPO_FLAG_OF, 0))
+// Nombre de bras robots
+#define LINE_NUM_ARMS (0 LINE_ARMS(TOPO_COUNT_ARM, 0))
+// Parties installées avant d'arriver à la position p
+#define LINE_INSTALLED_BEFORE(p) (0 LINE_ARMS(TOPO_INSTALLED_BEFORE, p))
+// Parties requises par les bras de la position p
+#define LINE_REQUIRED_AT(p) (0 LINE_ARMS(TOPO_REQUIRED_AT, p))
+
+// Position du dernier bras (bit de poids fort du masque des positions)
+#define TOPO_POSITIONS_MASK (0 LINE_ARMS(TOPO_POSITION_FLAG, 0))
+#define TOPO_ABOVE(n) ((TOPO_POSITIONS_MASK >> (n)) != 0)
+#define LINE_LAST_POSITION (TOPO_ABOVE(1) + TOPO_ABOVE(2) + TOPO_ABOVE(3) + TOPO_ABOVE(4) + \
+    TOPO_ABOVE(5) + TOPO_ABOVE(6) + TOPO_ABOVE(7) + TOPO_ABOVE(8) + TOPO_ABOVE(9) + \
+    TOPO_ABOVE(10) + TOPO_ABOVE(11) + TOPO_ABOVE(12) + TOPO_ABOVE(13) + TOPO_ABOVE(14) + \
+    TOPO_ABOVE(15))
+
+// END DERIVED
+// BEGIN STATIC CHECKS
+
+#define TOPO_POSITIONS(CHECK) \
+    CHECK(1) CHECK(2) CHECK(3) CHECK(4) CHECK(5) CHECK(6) CHECK(7) CHECK(8) \
+    CHECK(9) CHECK(10) CHECK(11) CHECK(12) CHECK(13) CHECK(14) CHECK(15)
+
+#define TOPO_CHECK_POSITION(p) \
+    _Static_assert((LINE_REQUIRED_AT(p) & ~LINE_INSTALLED_BEFORE(p)) == 0, \
+                   "an arm at position " #p " is placed before its dependencies"); \
+    _Static_assert((0 LINE_ARMS(TOPO_COUNT_LEFT, p)) <= 1, "two arms on the left of position " #p); \
+    _Static_assert((0 LINE_ARMS(TOPO_COUNT_RIGHT, p)) <= 1, "two arms on the right of position " #p);
+
+_Static_assert(MAX_POSITION <= 15, "TOPO_POSITIONS must list every position");
+_Static_assert((0 LINE_ARMS(TOPO_OUT_OF_RANGE, 0)) == 0, "arm position out of 1..MAX_POSITION");
+_Static_assert(LINE_INSTALLED_BEFORE(MAX_POSITION + 1) == LINE_COMPLETE_STATUS,
+               "the line never installs some parts: every car would fail");
+TOPO_POSITIONS(TOPO_CHECK_POSITION)
+
+// END STATIC CHECKS
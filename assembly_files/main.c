@@ -7,15 +7,20 @@
 
 #include "assembly.h"
 #include "assembly_library.h"
+#include "line_topology.h"
 
-pthread_t threads[7];
+#define NUM_ARMS LINE_NUM_ARMS
+#define ARM_ENTRY(x, part, side, position) {part, side, position, -1},
 
 assembly_line_t line;
 
+pool_t pool;
+
 sem_t sem_signal;
-sem_t sem_arm;
+sem_t sem_profile;
 sem_t sem_restart;
-sem_t sem_watchdog;
+spin_sem_t sem_watchdog;
+wait_site_t watchdog_site = WAIT_SITE("watchdog sem");
 
 timer_t watchdog_timer;
 
@@ -24,20 +29,21 @@ atomic_int watchdog_flag = 0;
 
 int PET_TIME = (int)(BELT_PERIOD*4);
 
+const char* profile_path = NULL;
+
+int stats_slot = -1;
+int watchdog_slot = -1;
+__thread int worker_slot = -1;
+
 typedef struct {
     int part;
     side_t side;
     int position;
+    int slot;
 } arm_task_t;
 
-arm_task_t arm[7] = {
-    {PART_FRAME, LEFT, 1},
-    {PART_ENGINE,LEFT, 2},
-    {PART_WHEELS,RIGHT, 2},
-    {PART_BODY,LEFT, 3},
-    {PART_DOORS,RIGHT, 4},
-    {PART_LIGHTS,LEFT, 4},
-    {PART_WINDOWS,RIGHT, 5}
+arm_task_t arm[NUM_ARMS] = {
+    LINE_ARMS(ARM_ENTRY, 0)
 };
 
 const char* part_to_string(int part) {
@@ -53,53 +59,73 @@ const char* part_to_string(int part) {
     }
 }
 
-void* arm_task_loop(void* arg) {
-    arm_task_t* task = (arm_task_t*)arg;
-    struct timespec ts; 
-
-    while(!shutdown_flag){
-        if(watchdog_flag) { 
-            sem_post(&sem_watchdog); 
-            printf_green("Arm for %s ready\n", part_to_string(task->part));
-        } // tell the watchdog that the arm is ready
-        sem_wait(&sem_arm); // wait to start
-
-        if(shutdown_flag) break; // check if shutdown is requested
+pool_task_t arm_tasks[NUM_ARMS];
+
+void track_worker(){
+    int id = pool_current_worker();
+    if(worker_slot != -1 || id < 0) return;
+    char name[32];
+    snprintf(name, sizeof(name), "worker %d", id);
+    if(register_thread_usage(line, name, &worker_slot) == OK) {
+        begin_thread_usage(line, worker_slot);
+    } else {
+        worker_slot = -2; // not tracked, reported by print_efficiency_report
+    }
+}
 
-        clock_gettime(CLOCK_REALTIME, &ts);
-        delay_until(&ts, (BELT_PERIOD * task->position + 10));
+int arm_task_run(pool_task_t* pool_task) {
+    arm_task_t* task = (arm_task_t*)pool_task->arg;
+    track_worker();
 
-        while(!shutdown_flag && !watchdog_flag) {
-            clock_gettime(CLOCK_REALTIME, &ts);
-            trigger_arm(line, task->side, task->position); // install the part
-            pet_watchdog(watchdog_timer, PET_TIME); // pet the watchdog
-            delay_until(&ts, BELT_PERIOD*7); // wait for the right time
-        }
+    if(shutdown_flag) return 0; // check if shutdown is requested
+    if(watchdog_flag) {
+        printf_green("Arm for %s ready\n", part_to_string(task->part));
+        spin_sem_post(&sem_watchdog); // tell the watchdog that the arm is ready
+        return 0; // wait for the restart
     }
 
-    printf_red("Arm for %s shutdown\n", part_to_string(task->part));
-    free(task);
-    return NULL;
+    begin_thread_usage(line, task->slot);
+    trigger_arm(line, task->side, task->position); // install the part
+    pet_watchdog(watchdog_timer, PET_TIME); // pet the watchdog
+    sample_thread_usage(line, task->slot);
+    sample_thread_usage(line, worker_slot);
+    return 1; // run again after one belt cycle
 }
 
 void setup_arms(){
-    for (int i = 0; i < 7; i++) {
+    for (int i = 0; i < NUM_ARMS; i++) {
         setup_arm(line, arm[i].part, arm[i].side, arm[i].position);
-    }
-}
-
-void create_arm_task(){
-    for (int i = 0; i < 7; i++) {
-        arm_task_t* task = malloc(sizeof(arm_task_t));
-        *task = arm[i];
-        pthread_create(&threads[i], NULL, arm_task_loop, task);
+        register_task_usage(line, part_to_string(arm[i].part), &arm[i].slot);
+        arm_tasks[i].run = arm_task_run;
+        arm_tasks[i].arg = &arm[i];
+        arm_tasks[i].period = BELT_PERIOD*(LINE_LAST_POSITION+2); // one belt cycle
     }
 }
 
 void* handle_show_stats(void* arg) {
+    begin_thread_usage(line, stats_slot);
     while(!shutdown_flag){
         sem_wait(&sem_signal);
         print_assembly_stats(line);
+        sample_thread_usage(line, stats_slot);
+        print_efficiency_report(line);
+        print_wait_stats(line);
+        print_wait_site(&watchdog_site);
+    }
+    return NULL;
+}
+
+void load_profiles(){
+    error_t res = load_fault_profiles(line, profile_path);
+    if(res == OK) { printf_green("Fault profiles loaded from %s\n", profile_path); }
+    else { printf_red("Cannot load fault profiles from %s (error %d)\n", profile_path, res); }
+}
+
+void* handle_reload_profile(void* arg) {
+    while(!shutdown_flag){
+        sem_wait(&sem_profile);
+        if(shutdown_flag) break;
+        load_profiles();
     }
     return NULL;
 }
@@ -108,58 +134,84 @@ void handler(int signum) {
     if(signum == SIGUSR1) { // new terminal "ps aux | grep nom_du_programme" -> kill -SIGUSR1 <pid>
         sem_post(&sem_signal);
     }
+    else if (signum == SIGHUP) { // kill -SIGHUP <pid> -> reload the fault profiles
+        if(profile_path) { sem_post(&sem_profile); }
+    }
     else if (signum == SIGINT) { // CTRL+C
         printf("Signal %d received. Shutting down...\n", signum);
         shutdown_flag = 1;
         shutdown_assembly(line); // shutdown the assembly line
         if(watchdog_flag) {
-            for (int i = 0; i < 7; i++) { sem_post(&sem_arm); }
-            for(int i = 0; i < 7; i++) { sem_post(&sem_watchdog); }
+            for(int i = 0; i < NUM_ARMS; i++) { spin_sem_post(&sem_watchdog); }
         }
     }
 }
 
 void start(){
-    for (int i = 0; i < 7; i++) { sem_post(&sem_arm); } // Launch the arms
+    for (int i = 0; i < NUM_ARMS; i++) { // Launch the arms
+        if(pool_submit(pool, &arm_tasks[i], BELT_PERIOD * arm[i].position + 10) != 0) {
+            printf_red("Arm for %s not started: pool full\n", part_to_string(arm[i].part));
+        }
+    }
     run_assembly(line); // run the assembly line
 }
 
 void watchdog_handler(union sigval arg) {
+    begin_thread_usage(line, watchdog_slot); // each expiry runs in a new thread
     if(!watchdog_flag && !shutdown_flag){
         printf_red("Watchdog !\n");
         watchdog_flag = 1;  
         shutdown_assembly(line); // shutdown the assembly line
     }
+    sample_thread_usage(line, watchdog_slot);
 }
 
 // MAIN
 
-int main(){
+int main(int argc, char** argv){
     //setup
     init_assembly_line(&line);
     setup_arms();
+    if(argc > 1) { // optional fault profile file
+        profile_path = argv[1];
+        load_profiles();
+    }
     printf("Setup done\n");
 
     // setup semaphores
-    sem_init(&sem_arm, 0, 0); // setup waiting semaphore for arms
     sem_init(&sem_signal, 0, 0); // setup semaphore for signal
-    sem_init(&sem_watchdog, 0, 0); // setup semaphore for watchdog
+    sem_init(&sem_profile, 0, 0); // setup semaphore for profile reload
+    spin_sem_init(&sem_watchdog, 0); // setup semaphore for watchdog
+
+    // setup cpu accounting
+    register_thread_usage(line, "stats", &stats_slot);
+    register_thread_usage(line, "watchdog", &watchdog_slot);
 
     // setup signal handler
     pthread_t thread;
     pthread_create(&thread, NULL, handle_show_stats, NULL);
+    pthread_t profile_thread;
+    pthread_create(&profile_thread, NULL, handle_reload_profile, NULL);
     handle_signal(SIGUSR1, handler);
+    handle_signal(SIGHUP, handler);
     handle_signal(SIGINT, handler);
 
     // setup watchdog
     watchdog_timer = watchdog_function(watchdog_handler); 
 
-    create_arm_task();
+    // one worker per core. After a watchdog, an arm may be submitted again
+    // before its previous run has returned, hence twice the arms
+    if(pool_create(&pool, 0, 2 * NUM_ARMS) != 0) {
+        printf_red("Cannot create the arm pool\n");
+        free_assembly_line(&line);
+        return 1;
+    }
+    printf("%d workers for %d arms\n", pool_size(pool), NUM_ARMS);
 
     while(!shutdown_flag){
         if(watchdog_flag) {
             printf_green("Wait for all arms to be ready\n");
-            for(int i = 0; i < 7; i++){ sem_wait(&sem_watchdog); } // wait for all arms to be ready
+            for(int i = 0; i < NUM_ARMS; i++){ spin_sem_wait(&sem_watchdog, &watchdog_site); } // wait for all arms to be ready
             watchdog_flag = 0;
             printf_green("Restarting...\n");
         }
@@ -171,11 +223,15 @@ int main(){
         start();
     }
 
-    for(int i = 0; i < 7; i++){ // wait all arm shutdown
-        pthread_join(threads[i], NULL);
+    pool_destroy(&pool); // wait all arm shutdown
+    for(int i = 0; i < NUM_ARMS; i++){
+        printf_red("Arm for %s shutdown\n", part_to_string(arm[i].part));
     }
 
     print_assembly_stats(line);
+    print_efficiency_report(line);
+    print_wait_stats(line);
+    print_wait_site(&watchdog_site);
     free_assembly_line(&line);
 
     return 0;
@@ -0,0 +1,29 @@
+# Profils de pannes pour les tests de charge : ./assembly stress.profile
+# Recharger pendant le fonctionnement : kill -SIGHUP <pid>
+
+[line]
+name = heavy-tail
+delay_law = pareto
+min_delay = 50
+max_delay = 900
+pareto_alpha = 1.2
+one_in_block_chance = 40
+# La probabilité de blocage passe de 1/40 à 1/10 en 5 minutes
+ramp_one_in_block_chance = 10
+ramp_duration = 300000
+# Rafale de 5 s toutes les minutes
+burst_period = 60000
+burst_length = 5000
+burst_one_in_block_chance = 3
+
+# Le bras de la carrosserie tombe en panne 10 s toutes les 2 minutes
+[arm left 3]
+name = body-outage
+delay_law = pareto
+min_delay = 50
+max_delay = 900
+pareto_alpha = 1.2
+one_in_block_chance = 40
+outage_start = 30000
+outage_length = 10000
+outage_period = 120000